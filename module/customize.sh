@@ -18,11 +18,22 @@ migrate_bswitcher_config() {
         cp -f "/data/adb/modules/BSwitcher/static_data.json" "$MODPATH/"
     fi
 
-    # 检查并复制 powerlog.json
-    if [ -f "/data/adb/modules/BSwitcher/powerlog.json" ]; then
+    # 检查并复制 powerlog.bin，旧版本只有 powerlog.json，启动时自动导入
+    if [ -f "/data/adb/modules/BSwitcher/powerlog.bin" ]; then
+        ui_print "尝试迁移功耗记录"
+        cp -f "/data/adb/modules/BSwitcher/powerlog.bin" "$MODPATH/"
+    elif [ -f "/data/adb/modules/BSwitcher/powerlog.json" ]; then
         ui_print "尝试迁移功耗记录"
         cp -f "/data/adb/modules/BSwitcher/powerlog.json" "$MODPATH/"
     fi
+
+    # 检查并复制 fps_probe.json 与 display_modes.json，系统指纹不符时会自动重新探测
+    if [ -f "/data/adb/modules/BSwitcher/fps_probe.json" ]; then
+        cp -f "/data/adb/modules/BSwitcher/fps_probe.json" "$MODPATH/"
+    fi
+    if [ -f "/data/adb/modules/BSwitcher/display_modes.json" ]; then
+        cp -f "/data/adb/modules/BSwitcher/display_modes.json" "$MODPATH/"
+    fi
 }
 
 if /system/bin/nc --help 2>&1 | grep -q -e "-U"; then
@@ -1,5 +1,12 @@
 #include "BSwitcher.hpp"
 #include <configlist.hpp>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+static constexpr uint64_t TOPAPP_PATHS = FileWatcher::pathBit(0) | FileWatcher::pathBit(1);  //与inotifyFiles的顺序对应
+static constexpr uint64_t RESTRICTED_PATHS = FileWatcher::pathBit(2) | FileWatcher::pathBit(3);
 
 std::string BSwitcher::command_callback(const std::string& key) {  //前端中按钮的响应
     if (key == "clear_monitoring") {
@@ -16,8 +23,11 @@ int BSwitcher::init_service() {
     schedulerConfigTarget = std::make_shared<SchedulerConfigTarget>();
     appListTarget = std::make_shared<ApplistConfigTarget>();
     availableModesTarget = std::make_shared<SimpleDataTarget>("availableModes", nlohmann::json::array({"powersave", "balance", "performance", "fast"}));
-    powerMonitorTarget = std::make_shared<PowerMonitorTarget>(&currentApp, &mainConfigTarget->config.dual_battery);
+    powerMonitorTarget = std::make_shared<PowerMonitorTarget>(&mainConfigTarget->config.dual_battery);
     dynamicFpsTarget = std::make_shared<DynamicFpsTarget>();
+    powerMonitorTarget->setRateSource(&dynamicFpsTarget->current_rate);
+    modeProfilerTarget = std::make_shared<ModeProfilerTarget>();
+    watcherStatsTarget = std::make_shared<WatcherStatsTarget>();
     configlistTarget = std::make_shared<SimpleDataTarget>("configlist", CONFIG_SCHEMA);
     configButtonTarget = std::make_shared<ConfigButtonTarget>(
         [this](const std::string& key) {
@@ -67,6 +77,8 @@ int BSwitcher::init_service() {
     jsonSocket->registerConfigTarget(powerMonitorTarget);
     jsonSocket->registerConfigTarget(configButtonTarget);
     jsonSocket->registerConfigTarget(dynamicFpsTarget);
+    jsonSocket->registerConfigTarget(modeProfilerTarget);
+    jsonSocket->registerConfigTarget(watcherStatsTarget);
     if (!jsonSocket->initialize()) {  //启动UNIX Socket
         return 0;
     }
@@ -78,18 +90,84 @@ int BSwitcher::init_service() {
         "/dev/cpuset/restricted/tasks"};        //可能有用
 
     fileWatcher = std::make_shared<FileWatcher>(inotifyFiles);
+    fileWatcher->setName("cgroup");  //应用启动时tasks会产生大量事件，默认的风暴抑制即可
+
+    watch_config();
 
     return 1;
 }
 
+void BSwitcher::watch_config() {  //监听所在目录而不是文件本身，才能收到编辑器以改名方式保存的结果
+    configWatcher = std::make_shared<FileWatcher>(std::vector<std::string>{".", "/data"}, 0, IN_CLOSE_WRITE | IN_MOVED_TO);
+    configWatcher->setName("config");
+    for (const char* dir : {".", "/data"}) {
+        configWatcher->setCallback(dir, [this](const std::string& path, uint32_t, const std::string& name) {  //只监听了写入完成与移入，不必区分
+            on_config_event(path, name);
+        });
+    }
+
+    bool watching = configWatcher->initialize();
+    if (!watching) {
+        LOGW("Config files are not watched, falling back to stat on read");
+    }
+    mainConfigTarget->setWatched(watching);
+    schedulerConfigTarget->setWatched(watching);
+}
+
+void BSwitcher::on_config_event(const std::string& dir, const std::string& name) {  //在Reactor线程中执行，只做标记，解析交给主循环
+    if (name.empty()) {
+        return;
+    }
+
+    if (dir == ".") {
+        if (name == "static_data.json") {  //静态模式在进程启动时决定，只能重启
+            LOGI("static_data.json changed, restarting worker");
+            staticDataChanged.store(true);
+        } else if ((name == mainConfigTarget->getFilename() && mainConfigTarget->onFileEvent()) ||
+                   (name == schedulerConfigTarget->getFilename() && schedulerConfigTarget->onFileEvent())) {
+            LOGI("%s changed externally", name.c_str());
+            configChanged.store(true);
+        } else {
+            return;
+        }
+    } else if (dir == "/data" && name == "powercfg.json" && !staticMode) {
+        LOGI("powercfg.json changed");
+        powercfgChanged.store(true);
+    } else {
+        return;
+    }
+    fileWatcher->kick();  //唤醒主循环立即处理
+}
+
+void BSwitcher::apply_config_events() {
+    if (configChanged.exchange(false)) {  //只有收到事件的文件会被重新解析
+        mainConfigTarget->reload();
+        schedulerConfigTarget->reload();
+    }
+    if (powercfgChanged.exchange(false)) {
+        std::lock_guard<std::mutex> lock(mainConfigTarget->configMutex);
+        mainConfigTarget->modify = true;  //由load_config重新解析
+    }
+}
+
 bool BSwitcher::unscene_write_mode(const std::string& mode) {  // 非scene模式写mode
+    lastWrite.executed = true;
     std::ofstream file(sState, std::ios::trunc);
     if (!file) {
-        return false;  // 文件打开失败
+        lastWrite.exit_code = errno ? errno : -1;  // 文件打开失败
+        lastWrite.output = "Cannot open " + sState + ": " + strerror(errno);
+        return false;
     }
 
     file << mode;
-    return !file.fail();
+    file.flush();
+    if (file.fail()) {
+        lastWrite.exit_code = errno ? errno : -1;
+        lastWrite.output = "Write failed: " + sState;
+        return false;
+    }
+    lastWrite.exit_code = 0;
+    return true;
 }
 
 bool BSwitcher::scene_write_mode(const std::string& mode) {  // scene模式写mode
@@ -99,15 +177,95 @@ bool BSwitcher::scene_write_mode(const std::string& mode) {  // scene模式写mo
         setenv("scene", currentApp.c_str(), 1);
         setenv("mode", mode.c_str(), 1);
     }
-    std::string command = "sh " + sEntry + " " + mode;
-    int result = std::system(command.c_str());
-    return result == 0;
+    lastWrite.executed = true;
+
+    /*输出写入memfd而不是管道：脚本常以&启动后台程序并继承stdout/stderr，
+      读管道要等到它们全部退出才有EOF；这里只等待sh本身，之后读取其中已有的内容*/
+    int outputFd = static_cast<int>(syscall(SYS_memfd_create, "mode_output", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int target = outputFd >= 0 ? outputFd : open("/dev/null", O_WRONLY);
+        if (target >= 0) {
+            dup2(target, STDOUT_FILENO);
+            dup2(target, STDERR_FILENO);
+        }
+        execl("/system/bin/sh", "sh", sEntry.c_str(), mode.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    if (pid < 0) {
+        lastWrite.exit_code = -1;
+        lastWrite.output = std::string("fork() failed: ") + strerror(errno);
+        if (outputFd >= 0) {
+            close(outputFd);
+        }
+        return false;
+    }
+
+    int status = 0;
+    pid_t waited;
+    do {
+        waited = waitpid(pid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+
+    if (outputFd >= 0) {  //只保留前面一部分
+        char buffer[ModeProfilerTarget::MAX_OUTPUT];
+        ssize_t n = pread(outputFd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            lastWrite.output.assign(buffer, static_cast<size_t>(n));
+        }
+        fcntl(outputFd, F_ADD_SEALS, F_SEAL_GROW);  //后台程序之后的写入直接失败，不再占用内存，也不会收到SIGPIPE
+        ftruncate(outputFd, 0);
+        close(outputFd);
+    }
+
+    if (waited < 0) {
+        lastWrite.exit_code = -1;
+    } else if (WIFEXITED(status)) {
+        lastWrite.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        lastWrite.exit_code = 128 + WTERMSIG(status);  //与shell的习惯一致
+    } else {
+        lastWrite.exit_code = -1;
+    }
+    return lastWrite.exit_code == 0;
 }
 
 bool BSwitcher::dummy_write_mode(const std::string& mode) {  //空的写函数，不实际操作
     return 1;
 }
 
+void BSwitcher::record_write(const std::string& mode, std::chrono::steady_clock::time_point start) {  //记录一次写入
+    if (!lastWrite.executed) {  //空写入不记录
+        return;
+    }
+
+    ModeSwitchRecord record;
+    record.from = appliedMode;
+    record.to = mode;
+    record.app = currentApp;
+    record.duration_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    record.exit_code = lastWrite.exit_code;
+    record.output = std::move(lastWrite.output);
+
+    if (record.exit_code != 0) {
+        LOGW("Mode %s -> %s failed with %d", record.from.c_str(), record.to.c_str(), record.exit_code);
+    }
+    modeProfilerTarget->record(std::move(record));
+    appliedMode = mode;
+}
+
+bool BSwitcher::apply_mode(const std::string& mode) {  //带记录的模式切换
+    lastWrite.executed = false;
+    lastWrite.exit_code = 0;
+    lastWrite.output.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    bool result = write_mode(mode);
+    record_write(mode, start);
+    return result;
+}
+
 void BSwitcher::init_thread() {
     if (mainConfigTarget->config.power_monitoring)  // 功耗监控
     {
@@ -127,13 +285,29 @@ void BSwitcher::init_thread() {
             dynamicFpsTarget->using_backdoor.store(mainConfigTarget->config.fps_backdoor, std::memory_order_relaxed);
             dynamicFpsTarget->backdoorid.store(mainConfigTarget->config.fps_backdoor_id, std::memory_order_relaxed);
             dynamicFpsTarget->down_during_ms.store(mainConfigTarget->config.fps_idle_time, std::memory_order_relaxed);
+            dynamicFpsTarget->tap_during_ms.store(mainConfigTarget->config.fps_tap_idle_time, std::memory_order_relaxed);
             dynamicFpsTarget->lowbri.store(mainConfigTarget->config.lowbri_for_fps, std::memory_order_relaxed);
+            dynamicFpsTarget->setInputFilter(mainConfigTarget->config.fps_stylus, mainConfigTarget->config.fps_keyboard);
 
             //启动
             dynamicFpsTarget->init();
+            dynamicFpsTarget->setContentAware(mainConfigTarget->config.fps_content_aware);
+
+            if (mainConfigTarget->config.lowbri_for_fps > 0) {  //亮度变化时立即加锁或解锁，不等主循环
+                if (backlightWatcher.start("/sys/class/backlight/panel0-backlight", [this](int brightness) {
+                        dynamicFpsTarget->setBrightness(brightness);
+                    }) &&
+                    backlightWatcher.brightness() >= 0) {
+                    dynamicFpsTarget->setBrightness(backlightWatcher.brightness());
+                }
+            } else {
+                backlightWatcher.stop();
+            }
         }
 
     } else {
+        backlightWatcher.stop();
+        dynamicFpsTarget->setContentAware(false);
         dynamicFpsTarget->stop();
     }
 }
@@ -146,6 +320,8 @@ int BSwitcher::load_config() {  //在此加载配置
     std::lock_guard<std::mutex> mLock(mainConfigTarget->configMutex);  // 获取锁
     mainConfigTarget->modify = false;
 
+    modeLimiter.configure(mainConfigTarget->config.switch_burst, mainConfigTarget->config.switch_refill_time * 1000);
+
     if (mainConfigTarget->config.poll_interval <= 1) {  //间隔时间为1以下时
         sleepDuring = std::chrono::milliseconds(100);
     } else {
@@ -229,7 +405,11 @@ int BSwitcher::load_config() {  //在此加载配置
                     }
 
                     if (lastscene == false) {  //避免多次init
+                        lastWrite.executed = false;
+                        lastWrite.output.clear();
+                        auto start = std::chrono::steady_clock::now();
                         scene_write_mode("init");
+                        record_write("init", start);
                     }
                 }
             } else  // 都不存在
@@ -304,10 +484,10 @@ bool BSwitcher::ScreenBrightness() {
                 int brightness = static_cast<int>(strtol(buf, &endptr, 10));
 
                 if (endptr != buf) {
-                    dynamicFpsTarget->currentbri.store(brightness, std::memory_order_relaxed);
+                    dynamicFpsTarget->setBrightness(brightness);
                     return (brightness > 0);
                 } else {
-                    dynamicFpsTarget->currentbri.store(255, std::memory_order_relaxed);
+                    dynamicFpsTarget->setBrightness(255);
                 }
             }
         } else {
@@ -384,6 +564,8 @@ bool BSwitcher::init() {
 void BSwitcher::main_loop() {
     std::string newMode;
     std::string lastMode = "";
+    std::string lastApp = "";
+    std::string deferredMode = "";  //被限流挂起的模式
 
     auto& mainModify = mainConfigTarget->modify;
     auto& mainConfig = mainConfigTarget->config;
@@ -393,17 +575,35 @@ void BSwitcher::main_loop() {
     auto& schedulerConfig = schedulerConfigTarget->config;
 
     int timeset = 10000;
+    bool screenOn = true;
+    bool appStale = true;  //上一轮没有检测前台
 
     TopAppDetector topAppDetector;
+    FileWatcher::Subscription cgroupSub = fileWatcher->subscribe();
 
     LOGD("Ready, entering main loop.");
     while (1)  // 主循环
     {
-        load_config();  //加载配置
+        if (unlikely(staticDataChanged.load())) {
+            powerMonitorTarget->stop();  //_exit不执行析构，先写入功耗记录的检查点
+            _exit(0);                    //由守护进程重新拉起，重新读取static_data.json
+        }
+        apply_config_events();
+
+        bool reloaded = (load_config() != 1);  //加载配置
+
+        std::this_thread::sleep_for(sleepDuring);  //等待
+        uint64_t dirty = 0;
+        bool woke = fileWatcher->wait(cgroupSub, timeset, &dirty);  // 阻塞等待cgroup变化
 
-        std::this_thread::sleep_for(sleepDuring);              //等待
-        fileWatcher->wait(timeset);                            // 阻塞等待cgroup变化
-        std::this_thread::sleep_for(std::chrono::seconds(1));  // 等1秒防抖，避免出现none
+        bool fullCheck = reloaded || !woke || dirty == 0;  //超时、未启用inotify或不知道哪里变化时全量检查
+        bool checkScreen = fullCheck || (dirty & RESTRICTED_PATHS);
+        bool checkApp = fullCheck || (dirty & TOPAPP_PATHS);
+
+        if (checkApp) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));  // 等1秒防抖，避免出现none
+            fileWatcher->poll(cgroupSub);                          // 防抖期间的变化一并处理
+        }
 
         {
             std::unique_lock<std::mutex> mLock(mainMutex);
@@ -412,24 +612,38 @@ void BSwitcher::main_loop() {
             }
             int ufps = mainConfig.up_fps > 0 ? mainConfig.up_fps : 120;
             int dfps = mainConfig.down_fps > 0 ? mainConfig.down_fps : 60;
+            std::string decay = mainConfig.fps_decay;
+            std::string contentApp;  //熄屏与低电量时不采样内容帧率
 
             timeset = 40000;
-            if (!ScreenState()) {
+            if (checkScreen) {  //只有top-app变化时沿用上次的屏幕状态
+                screenOn = ScreenState();
+            }
+
+            if (!screenOn) {
                 newMode = sceneStrict ? "standby" : mainConfig.screen_off;  //在严格的scene模式下使用standby
                 timeset = 180000;                                           //降低检查频率
+                appStale = true;
                 LOGD("Found screen off,Increase sleep time");
 
             } else if (getBatteryLevel() < mainConfig.low_battery_threshold) {  //低电量
                 newMode = "powersave";
                 ufps = 60;
                 dfps = 60;
+                decay.clear();
+                appStale = true;
             } else {
                 newMode = schedulerConfig.defaultMode;
                 {
                     mLock.unlock();
                     std::lock_guard<std::mutex> sLock(schedulerMutex);
 
-                    currentApp = topAppDetector.getForegroundApp();
+                    if (checkApp || appStale) {  //只有restricted变化时沿用上次的前台应用
+                        currentApp = topAppDetector.getForegroundApp();
+                        powerMonitorTarget->setForegroundApp(currentApp);
+                        appStale = false;
+                    }
+                    contentApp = currentApp;
                     LOGD("CurrentAPP: %s", currentApp.c_str());
 
                     if (!currentApp.empty()) {                        //未获取到时跳过
@@ -437,8 +651,11 @@ void BSwitcher::main_loop() {
                         {                                             // 遍历app列表
                             if (app.pkgName == currentApp) {
                                 newMode = app.mode;
-                                if (app.down_fps > 0) {
+                                if (!app.fps_decay.empty()) {  //应用的曲线优先，其次是应用的down_fps
+                                    decay = app.fps_decay;
+                                } else if (app.down_fps > 0) {
                                     dfps = app.down_fps;
+                                    decay.clear();
                                 }
                                 if (app.up_fps > 0) {
                                     ufps = app.up_fps;
@@ -452,19 +669,32 @@ void BSwitcher::main_loop() {
             }
             dynamicFpsTarget->up_fps.store(ufps, std::memory_order_relaxed);
             dynamicFpsTarget->down_fps.store(dfps, std::memory_order_relaxed);
+            dynamicFpsTarget->setDecay(decay);
+            dynamicFpsTarget->setContentPackage(contentApp);
+            dynamicFpsTarget->setScreenOn(screenOn);
         }
-        if (sceneStrict) {  //严格scene时
-            static std::string lastapp = "";
-            if (currentApp != lastapp) {
-                write_mode(newMode);
-                lastapp = currentApp;
-                LOGI("Updated to: %s", newMode.c_str());
-            }
-        } else if (lastMode != newMode)  // 有变化时
-        {
-            write_mode(newMode);
+
+        bool changed = sceneStrict ? (currentApp != lastApp)  //严格scene时每次切换应用都要写
+                                   : (lastMode != newMode);   // 有变化时
+        if (!changed) {
+            deferredMode.clear();  //已回到当前模式，放弃挂起的切换
+        } else if (!screenOn || modeLimiter.tryAcquire()) {  //熄屏(screen_off/standby)不受限流，也不消耗令牌
+            apply_mode(newMode);
+            powerMonitorTarget->setMode(newMode);
             lastMode = newMode;
+            lastApp = currentApp;
+            if (!deferredMode.empty()) {
+                LOGI("Deferred switch applied: %s", newMode.c_str());
+                deferredMode.clear();
+            }
             LOGI("Updated to: %s", newMode.c_str());
+        } else {  //令牌耗尽，挂起到下一个令牌可用时
+            if (deferredMode != newMode) {
+                modeProfilerTarget->recordThrottle(currentApp, appliedMode, newMode);
+                LOGI("Switch to %s deferred by rate limit", newMode.c_str());
+            }
+            deferredMode = newMode;
+            timeset = std::min(timeset, modeLimiter.msUntilToken());  //届时重新评估并应用最新的模式
         }
     }
 }
@@ -3,14 +3,19 @@
 #include <JSONSocketModule/ApplistModule.hpp>
 #include <JSONSocketModule/ConfigModule.hpp>
 #include <JSONSocketModule/InformationModule.hpp>
+#include <JSONSocketModule/ModeProfiler.hpp>
 #include <JSONSocketModule/MonitorModule.hpp>
+#include <JSONSocketModule/WatcherModule.hpp>
 #include <JSONSocketModule/DynamicFps.hpp>
+#include <atomic>
+#include <backlight.hpp>
 #include <chrono>
 #include <filesystem>
 #include <inotifywatcher.hpp>
 #include <iostream>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <ratelimiter.hpp>
 #include <sched.h>
 #include <string>
 #include <thread>
@@ -37,8 +42,16 @@ private:
     std::shared_ptr<PowerMonitorTarget> powerMonitorTarget;
     std::shared_ptr<ConfigButtonTarget> configButtonTarget;
     std::shared_ptr<DynamicFpsTarget> dynamicFpsTarget;
+    std::shared_ptr<ModeProfilerTarget> modeProfilerTarget;
+    std::shared_ptr<WatcherStatsTarget> watcherStatsTarget;
 
-    std::shared_ptr<FileWatcher> fileWatcher;  //管理inotify
+    std::shared_ptr<FileWatcher> fileWatcher;    //管理inotify
+    std::shared_ptr<FileWatcher> configWatcher;  //监听配置文件的修改
+    BacklightWatcher backlightWatcher;           //低亮度锁60时跟踪亮度
+
+    std::atomic<bool> staticDataChanged{false};  //static_data.json变化后需要重启工作进程
+    std::atomic<bool> configChanged{false};      //config.json或scheduler_config.json被外部修改
+    std::atomic<bool> powercfgChanged{false};    //powercfg.json被修改
 
     std::string sState = "";                                                  //状态文件入口
     std::string sEntry = "";                                                  //状态脚本入口，一般/data/powercfg.sh
@@ -46,6 +59,16 @@ private:
 
     std::function<bool(const std::string&)> write_mode;  //写状态函数
 
+    struct {
+        bool executed = false;  //是否真正执行了写入
+        int exit_code = 0;
+        std::string output;
+    } lastWrite;  //最近一次写入的结果，由各写函数填写
+
+    std::string appliedMode = "";  //最近一次实际应用的模式
+
+    TokenBucket modeLimiter;  //模式切换限流
+
     static_data _staticData;  //静态数据
 
     bool sceneStrict = false;     //严格scene
@@ -62,8 +85,18 @@ private:
 
     bool dummy_write_mode(const std::string& mode);  //空的写函数，防段错误
 
+    bool apply_mode(const std::string& mode);  //带记录的模式切换
+
+    void record_write(const std::string& mode, std::chrono::steady_clock::time_point start);  //记录一次写入
+
     void init_thread();
 
+    void watch_config();  //监听配置文件，外部修改立即生效
+
+    void on_config_event(const std::string& dir, const std::string& name);
+
+    void apply_config_events();  //在主循环中应用配置文件的变化
+
     int load_config();  //在此加载配置
 
     bool ScreenBrightness();
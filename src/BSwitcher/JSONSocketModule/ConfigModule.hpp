@@ -3,6 +3,7 @@
 #define CONFIG_MODULE_HPP
 
 #include "JSONSocket/JSONSocket.hpp"
+#include <atomic>
 #include <fstream>
 #include <mutex>
 #include <string>
@@ -24,22 +25,78 @@
     CONFIG_ITEM(std::string, custom_mode, "")         \
     CONFIG_ITEM(bool, dynamic_fps, false)             \
     CONFIG_ITEM(int, fps_idle_time, 2500)             \
+    CONFIG_ITEM(int, fps_tap_idle_time, 0)            \
+    CONFIG_ITEM(std::string, fps_decay, "")           \
+    CONFIG_ITEM(bool, fps_stylus, true)               \
+    CONFIG_ITEM(bool, fps_keyboard, false)            \
+    CONFIG_ITEM(bool, fps_content_aware, false)       \
     CONFIG_ITEM(int, down_fps, 60)                    \
     CONFIG_ITEM(int, up_fps, 120)                     \
     CONFIG_ITEM(bool, fps_backdoor, false)            \
     CONFIG_ITEM(int, fps_backdoor_id, 1035)           \
     CONFIG_ITEM(std::string, screen_resolution, "")   \
-    CONFIG_ITEM(int, lowbri_for_fps, -10)   
+    CONFIG_ITEM(int, lowbri_for_fps, -10)             \
+    CONFIG_ITEM(int, switch_burst, 0)                 \
+    CONFIG_ITEM(int, switch_refill_time, 20)
 
 // 文件配置目标基类
+// 有inotify监听时只在收到事件后重新解析，否则退回到每次读取时stat
 class FileConfigTarget : public ConfigTarget {
 protected:
     std::string filename;
-    time_t last_stat_time_ = 0;
+
+    std::mutex stat_mutex_;
+    struct stat last_stat_ = {};
+    std::atomic<bool> watched_{false};
+    std::atomic<bool> changed_{true};  //首次总是加载
+
+    bool statChanged() {  //与上次记录的文件状态比较并更新，纳秒级mtime
+        struct stat st = {};
+        if (stat(filename.c_str(), &st) != 0) {
+            st = {};
+        }
+        std::lock_guard<std::mutex> lock(stat_mutex_);
+        bool differ = st.st_ino != last_stat_.st_ino ||
+                      st.st_size != last_stat_.st_size ||
+                      st.st_mtim.tv_sec != last_stat_.st_mtim.tv_sec ||
+                      st.st_mtim.tv_nsec != last_stat_.st_mtim.tv_nsec;
+        last_stat_ = st;
+        return differ;
+    }
+
+    bool needReload() {  //加载前调用
+        if (watched_.load()) {
+            if (changed_.exchange(false)) {
+                statChanged();  //记下当前状态，用于过滤自己写入产生的事件
+                return true;
+            }
+            return false;
+        }
+        return statChanged();
+    }
 
 public:
     explicit FileConfigTarget(const std::string& filename) : filename(filename) {}
 
+    const std::string& getFilename() const {
+        return filename;
+    }
+
+    void setWatched(bool watched) {  //由外部的inotify监听负责通知变化
+        watched_.store(watched);
+        changed_.store(true);
+    }
+
+    bool onFileEvent() {  //收到文件事件，返回是否真的有变化
+        if (!statChanged()) {
+            return false;
+        }
+        changed_.store(true);
+        return true;
+    }
+
+    virtual void reload() {}  //重新加载到内存
+
     nlohmann::json write(const nlohmann::json& data) override {
         try {
             std::ofstream file(filename);
@@ -48,6 +105,8 @@ public:
                 return {{"status", "error"}, {"message", "Cannot open file for writing"}};
             }
             file << data.dump(4);
+            file.close();
+            statChanged();  //自己写入的内容已在内存中，不需要再解析
             return {{"status", "success"}};
         } catch (const std::exception& e) {
             LOGE("Failed to write file %s: %s", filename.c_str(), e.what());
@@ -98,12 +157,9 @@ private:
     };
 
     void loadFromFile() {
-        struct stat file_stat;
-        stat(filename.c_str(), &file_stat);
-        if (last_stat_time_ == file_stat.st_mtime) {
+        if (!needReload()) {
             return;
         }
-        last_stat_time_ = file_stat.st_mtime;
 
         LOGD("Loading : %s", filename.c_str());
 
@@ -195,6 +251,10 @@ public:
         return "config";
     }
 
+    void reload() override {
+        loadFromFile();
+    }
+
     nlohmann::json read() override {
         loadFromFile();
 
@@ -234,6 +294,7 @@ public:
         std::string mode;
         int up_fps;
         int down_fps;
+        std::string fps_decay;  //空时使用全局设置
     };
 
     struct SchedulerConfig {
@@ -251,12 +312,9 @@ private:
         {"rules", nlohmann::json::array()}};
 
     void loadFromFile() {
-        struct stat file_stat;
-        stat(filename.c_str(), &file_stat);
-        if (last_stat_time_ == file_stat.st_mtime) {
+        if (!needReload()) {
             return;
         }
-        last_stat_time_ = file_stat.st_mtime;
 
         LOGD("Loading : %s", filename.c_str());
         auto fileData = FileConfigTarget::read();
@@ -282,6 +340,7 @@ private:
                         appMode.mode = rule.value("mode", "");
                         appMode.up_fps = rule.value("up_fps", -1);
                         appMode.down_fps = rule.value("down_fps", -1);
+                        appMode.fps_decay = rule.value("fps_decay", "");
                         if (!appMode.pkgName.empty() && !appMode.mode.empty()) {
                             config.apps.push_back(appMode);
                         }
@@ -313,6 +372,7 @@ private:
                 rule["mode"] = app.mode;
                 rule["up_fps"] = app.up_fps;
                 rule["down_fps"] = app.down_fps;
+                rule["fps_decay"] = app.fps_decay;
                 rulesArray.push_back(rule);
             }
             fileData["rules"] = rulesArray;
@@ -329,6 +389,10 @@ public:
         return "scheduler";
     }
 
+    void reload() override {
+        loadFromFile();
+    }
+
     nlohmann::json read() override {
         loadFromFile();
 
@@ -343,6 +407,7 @@ public:
             rule["mode"] = app.mode;
             rule["up_fps"] = app.up_fps;
             rule["down_fps"] = app.down_fps;
+            rule["fps_decay"] = app.fps_decay;
             rulesArray.push_back(rule);
         }
         result["rules"] = rulesArray;
@@ -369,6 +434,7 @@ public:
                             appMode.mode = rule.value("mode", config.defaultMode);
                             appMode.up_fps = rule.value("up_fps", -1);
                             appMode.down_fps = rule.value("down_fps", -1);
+                            appMode.fps_decay = rule.value("fps_decay", "");
 
                             tmpapplist.push_back(appMode);
                         }
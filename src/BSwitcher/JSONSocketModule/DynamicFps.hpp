@@ -1,50 +1,180 @@
 /* 动态刷新率的简单实现 */
 /* 参考了来自yc9559的Dfps：https://github.com/yc9559/dfps/ */
+/* 手指按下期间保持高刷，抬起后开始计时降低 */
 #ifndef DYNAMIC_FPS
 #define DYNAMIC_FPS
 
 #include "JSONSocket/JSONSocket.hpp"
-#include "inotifywatcher.hpp"
+#include "childsupervisor.hpp"
+#include "cmdchannel.hpp"
+#include "contentrate.hpp"
+#include "fpsprobe.hpp"
+#include "histogram.hpp"
+#include "inputreader.hpp"
 #include <Alog.hpp>
 #include <atomic>
 #include <filesystem>
+#include <fstream>
 #include <set>
-#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <thread>
 
 class DynamicFpsTarget : public ConfigTarget {
+public:
+    struct DecayStep {  //抬起后ms毫秒切换到fps
+        int fps;
+        int ms;
+    };
+
+    struct DisplayModes {
+        std::unordered_map<std::string, std::map<int, int>> byResolution;  //分辨率 -> 刷新率 -> 模式id
+        std::vector<int> rates;                                             //所有可用的刷新率，含alternativeRefreshRates
+    };
+
 private:
-    std::shared_ptr<FileWatcher> fileWatcher;
-    std::vector<std::string> filePaths;
+    InputReader inputReader;
+    CommandChannel channel;  //常驻sh，刷新率命令经由它执行
+    int epoll_fd_{-1};
+    int wake_fd_{-1};  //stop时唤醒工作线程
+    int idle_fd_{-1};  //空闲定时器，到期后降低刷新率
     std::thread worker_thread_;
     std::atomic<bool> running_{false};
     int currentfps = 0;
 
-    std::atomic<std::chrono::steady_clock::time_point> _target_time;
-    std::atomic<bool> _imrun{false};
+    const std::string PROBE_FILE = "./fps_probe.json";
+    static constexpr const char* MODES_FILE = "./display_modes.json";
+    std::vector<RefreshRateProbe::Key> settingsKeys = RefreshRateProbe::candidates();  //实际写入的项
+    bool keysProbed = false;
+    bool probe_pending_ = false;  //没有缓存，等亮屏且空闲时探测，仅工作线程使用
+    std::string probe_fp_;        //待探测系统的指纹，仅工作线程使用
+    std::thread probe_thread_;    //探测要反复切换刷新率并等待生效，在后台进行，不阻塞输入
+    std::atomic<bool> probing_{false};     //置false即中止探测
+    std::atomic<bool> probe_done_{false};  //探测线程已结束，等工作线程回收
+    std::atomic<bool> screen_on_{true};
+
+    std::string decay_spec_;
+    std::vector<DecayStep> decay_;  //配置的降频曲线，空时使用down_fps与down_during_ms
+    std::vector<DecayStep> curve_;  //本次空闲实际执行的曲线，仅工作线程使用
+    size_t decay_index_ = 0;
+    bool bri_locked_ = false;  //低亮度锁60是否生效，仅工作线程使用
+    int applied_content_ = 0;  //已按其生成曲线的内容帧率，仅工作线程使用
+
+    //统计，rate_ms_等由fpsMutex保护
+    std::map<int, double> rate_ms_;  //各刷新率累计停留时间
+    std::chrono::steady_clock::time_point rate_since_ = std::chrono::steady_clock::now();
+    uint64_t transitions_ = 0;
+    std::atomic<uint64_t> idle_expirations_{0};
+    RollingHistogram applyLatency_;  //命令从提交到完成
+    RollingHistogram touchLatency_;  //从按下到升高的命令完成
+    bool touch_pending_ = false;     //正在处理按下，仅工作线程使用
+    uint64_t touch_seq_ = 0;
 
     nlohmann::json fpslist;
     mutable std::mutex fpsMutex;
 
+    std::atomic<int> content_rate_{0};  //前台应用稳定的内容帧率，0为未知
+    ContentRateSampler sampler_;        //放在最后，析构时最先停止，回调不会访问已销毁的成员
+
 public:
     const std::unordered_map<std::string, std::map<int, int>> allfpsmap;  //带分辨率的列表
     std::atomic<const std::map<int, int>*> fpsmap;                        //当前列表
     std::atomic<int> up_fps{120};
     std::atomic<int> down_fps{60};
+    std::atomic<int> current_rate{0};  //当前设定的刷新率，供功耗统计读取，0为未知或未运行
     std::atomic<int> lowbri{-10};
     std::atomic<int> currentbri{1000};
 
     std::atomic<int> down_during_ms{2500};
+    std::atomic<int> tap_during_ms{0};  //点击后的空闲时间，0时与down_during_ms相同
 
     std::atomic<int> backdoorid{1035};
     std::atomic<bool> using_backdoor{false};
 
+    bool use_stylus = true;     //手写笔也触发
+    bool use_keyboard = false;  //键盘也触发
+
     std::string getName() const override {
         return "dynamicFps";
     }
 
     nlohmann::json read() override {
-        return fpslist;
+        nlohmann::json result;
+        result["fpslist"] = fpslist;
+
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);
+            nlohmann::json keys = nlohmann::json::array();
+            for (const auto& key : settingsKeys) {
+                keys.push_back(key.ns + "/" + key.name);
+            }
+            result["settings"] = {{"probed", keysProbed}, {"keys", keys}};
+
+            nlohmann::json decay = nlohmann::json::array();
+            for (const auto& step : decay_) {
+                decay.push_back({{"fps", step.fps}, {"ms", step.ms}});
+            }
+            result["decay"] = decay;
+
+            nlohmann::json timeMs = nlohmann::json::object();
+            auto rates = rate_ms_;
+            if (currentfps > 0) {
+                rates[currentfps] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - rate_since_).count();
+            }
+            for (const auto& [rate, ms] : rates) {
+                timeMs[std::to_string(rate)] = static_cast<uint64_t>(ms);
+            }
+            result["state"] = {{"current_fps", currentfps},
+                               {"content_rate", content_rate_.load(std::memory_order_relaxed)},
+                               {"transitions", transitions_},
+                               {"idle_expirations", idle_expirations_.load(std::memory_order_relaxed)},
+                               {"time_ms", timeMs}};
+        }
+
+        nlohmann::json devices = nlohmann::json::array();
+        for (const auto& stats : inputReader.getStats()) {
+            devices.push_back({{"path", stats.path},
+                               {"name", stats.name},
+                               {"class", InputReader::className(stats.cls)},
+                               {"monitored", stats.monitored},
+                               {"wakeups", stats.wakeups},
+                               {"boosts", stats.boosts},
+                               {"spurious", stats.spurious}});
+        }
+        result["devices"] = devices;
+
+        result["state"]["apply_latency"] = applyLatency_.toJson();
+        result["state"]["touch_latency"] = touchLatency_.toJson();
+
+        auto stats = channel.getStats();
+        result["channel"] = {{"alive", stats.alive},
+                             {"restarts", stats.restarts},
+                             {"commands", stats.commands},
+                             {"failures", stats.failures},
+                             {"avg_ms", stats.commands ? stats.total_ms / stats.commands : 0.0},
+                             {"max_ms", stats.max_ms},
+                             {"last_ms", stats.last_ms},
+                             {"avg_cpu_ms", stats.commands ? stats.cpu_ms / stats.commands : 0.0},
+                             {"last_cpu_ms", stats.last_cpu_ms}};
+
+        auto children = ChildSupervisor::instance().getStats();
+        nlohmann::json commands = nlohmann::json::object();
+        for (const auto& [tag, tagStats] : children.tags) {
+            uint64_t exited = tagStats.exits;
+            commands[tag] = {{"spawns", tagStats.spawns},
+                             {"failures", tagStats.failures},
+                             {"spawn_errors", tagStats.spawn_errors},
+                             {"avg_ms", exited ? tagStats.total_ms / exited : 0.0},
+                             {"max_ms", tagStats.max_ms},
+                             {"last_exit", tagStats.last_exit}};
+        }
+        result["children"] = {{"spawned", children.spawned},
+                              {"reaped", children.reaped},
+                              {"running", children.running},
+                              {"pidfd", children.pidfd},
+                              {"commands", commands}};
+        return result;
     }
 
     nlohmann::json write(const nlohmann::json& jsonData) override {
@@ -52,27 +182,107 @@ public:
     }
 
     DynamicFpsTarget()
-        : allfpsmap(getResolutionToDisplayModes()) {
-        std::vector<std::string> filePaths;
-        try {
-            for (const auto& entry : std::filesystem::directory_iterator("/dev/input")) {
-                if (entry.is_character_file()) {
-                    filePaths.push_back(entry.path().string());
-                }
+        : DynamicFpsTarget(loadDisplayModes()) {}
+
+    explicit DynamicFpsTarget(DisplayModes modes)
+        : allfpsmap(std::move(modes.byResolution)) {
+        fpslist = modes.rates;
+
+        fpsmap = &allfpsmap.begin()->second;  //随便指一个
+    }
+
+    static std::vector<DecayStep> parseDecay(const std::string& spec) {  //"90:1000,60:3000,30:10000"
+        std::vector<DecayStep> steps;
+        std::istringstream iss(spec);
+        std::string token;
+        while (std::getline(iss, token, ',')) {
+            DecayStep step = {0, -1};
+            if (sscanf(token.c_str(), " %d : %d", &step.fps, &step.ms) == 2 && step.fps > 0 && step.ms >= 0) {
+                steps.push_back(step);
+            } else if (token.find_first_not_of(" \t") != std::string::npos) {
+                LOGW("Invalid fps_decay step: %s", token.c_str());
             }
-        } catch (const std::filesystem::filesystem_error& ex) {
-            LOGE("Failed to load input, DynamicFps could not be enabled.");
+        }
+        std::stable_sort(steps.begin(), steps.end(), [](const DecayStep& a, const DecayStep& b) { return a.ms < b.ms; });
+        return steps;
+    }
+
+    void setBrightness(int brightness) {  //亮度变化，跨过lowbri时唤醒工作线程立即加锁或解锁
+        int threshold = lowbri.load(std::memory_order_relaxed);
+        int before = currentbri.exchange(brightness, std::memory_order_relaxed);
+        if ((before < threshold) == (brightness < threshold)) {
+            return;
+        }
+        wake();
+    }
+
+    void wake() {  //唤醒工作线程重新检查亮度锁与内容帧率
+        std::lock_guard<std::mutex> lock(fpsMutex);
+        if (wake_fd_ >= 0) {
+            uint64_t one = 1;
+            ssize_t result = ::write(wake_fd_, &one, sizeof(one));
+            (void)result;
+        }
+    }
+
+    void setContentAware(bool enable) {  //按前台内容帧率限制降频
+        if (enable) {
+            sampler_.start([this](int rate) {
+                content_rate_.store(rate, std::memory_order_relaxed);
+                wake();
+            });
             return;
         }
-        fileWatcher = std::make_shared<FileWatcher>(filePaths, 300, IN_ACCESS);  //一些设备使用IN_MODIFY没有响应
+        sampler_.stop();
+        if (content_rate_.exchange(0, std::memory_order_relaxed) != 0) {
+            wake();
+        }
+    }
 
-        fpslist = getAvailableRefreshRates();
+    void setContentSource(std::unique_ptr<ContentRateSource> source) {  //替换采样来源，在setContentAware之前调用
+        sampler_.setSource(std::move(source));
+    }
 
-        fpsmap = &allfpsmap.begin()->second;  //随便指一个
+    void setContentPackage(const std::string& package) {  //前台应用，空表示不采样
+        sampler_.setPackage(package);
+    }
+
+    void setScreenOn(bool on) {  //熄屏时中止探测，此时模式不会跟随设置变化
+        screen_on_.store(on, std::memory_order_relaxed);
+        if (!on) {
+            probing_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void setDecay(const std::string& spec) {  //下次抬起时生效
+        std::lock_guard<std::mutex> lock(fpsMutex);
+        if (spec == decay_spec_) {
+            return;
+        }
+        decay_spec_ = spec;
+        decay_ = parseDecay(spec);
+    }
+
+    void setInputFilter(bool stylus, bool keyboard) {  //改变时重新打开设备
+        if (stylus == use_stylus && keyboard == use_keyboard) {
+            return;
+        }
+        use_stylus = stylus;
+        use_keyboard = keyboard;
+        if (running_.load()) {
+            stop();
+            init();
+        }
     }
 
     void init() {
         if (!running_.exchange(true)) {
+            inputReader.setFilter(use_stylus, use_keyboard);
+            if (!open_loop()) {  //在启动线程前准备好，stop总能唤醒它
+                close_loop();
+                running_.store(false);
+                return;
+            }
             worker_thread_ = std::thread(&DynamicFpsTarget::work, this);
             LOGD("DynamicFpsTarget Started");
         }
@@ -81,10 +291,17 @@ public:
     void stop() {
         if (running_.exchange(false)) {
             LOGD("DynamicFpsTarget Stoped");
-            fileWatcher->cleanup();  //cleanup会立即触发wait
+            if (wake_fd_ >= 0) {
+                uint64_t one = 1;
+                ssize_t result = ::write(wake_fd_, &one, sizeof(one));
+                (void)result;
+            }
             if (worker_thread_.joinable()) {
                 worker_thread_.join();
             }
+            close_loop();  //线程退出后再关闭，stop返回时不再有任何定时或读取
+            sampler_.setActive(true);  //按下后未抬起就停止时，不让采样一直暂停
+            current_rate.store(0, std::memory_order_relaxed);
         }
     }
 
@@ -103,180 +320,526 @@ public:
     }
 
 private:
+    bool open_loop() {  //创建epoll与唤醒fd，打开输入设备
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);
+            wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        idle_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epoll_fd_ < 0 || wake_fd_ < 0 || idle_fd_ < 0) {
+            LOGE("DynamicFps: failed to create epoll/eventfd/timerfd: %s", strerror(errno));
+            return false;
+        }
+
+        for (int fd : {wake_fd_, idle_fd_}) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+                LOGE("DynamicFps: failed to add fd to epoll: %s", strerror(errno));
+                return false;
+            }
+        }
+
+        if (!inputReader.attach(epoll_fd_)) {
+            LOGE("Failed to load input, DynamicFps could not be enabled.");
+            return false;
+        }
+
+        channel.setHook([this](uint64_t seq, double ms, int rc) { on_applied(seq, ms, rc); });
+        if (!channel.start(epoll_fd_)) {
+            LOGW("DynamicFps: command channel unavailable, forking per change");
+        }
+        return true;
+    }
+
+    void close_loop() {
+        channel.stop();
+        inputReader.detach();
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);  //setBrightness可能在其他线程中写入
+            if (wake_fd_ >= 0) {
+                close(wake_fd_);
+                wake_fd_ = -1;
+            }
+        }
+        if (idle_fd_ >= 0) {
+            close(idle_fd_);
+            idle_fd_ = -1;
+        }
+        if (epoll_fd_ >= 0) {
+            close(epoll_fd_);
+            epoll_fd_ = -1;
+        }
+    }
+
+    int top_fps() const {
+        if (lowbri.load(std::memory_order_relaxed) <= currentbri.load(std::memory_order_relaxed)) {
+            return up_fps.load(std::memory_order_relaxed);
+        }
+        return 60;  //低亮度锁60
+    }
+
+    void apply_brightness() {  //亮度跨过lowbri：变暗时立即降到60，变亮时若仍在触摸则恢复
+        bool locked = lowbri.load(std::memory_order_relaxed) > currentbri.load(std::memory_order_relaxed);
+        if (locked == bri_locked_) {
+            return;
+        }
+        bri_locked_ = locked;
+        LOGD("Low brightness lock %s", locked ? "on" : "off");
+        if (locked) {
+            if (currentfps > 60) {
+                change_fps(60);
+            }
+        } else if (inputReader.touching()) {
+            change_fps(top_fps());
+        }
+    }
+
+    int align_content(int fps) const {  //抬高到内容帧率的最低整数倍，面板不支持时保持原值
+        int content = content_rate_.load(std::memory_order_relaxed);
+        auto tfpsmap = fpsmap.load(std::memory_order_relaxed);
+        if (content <= 0 || !tfpsmap) {
+            return fps;
+        }
+        for (const auto& [rate, id] : *tfpsmap) {
+            if (rate >= fps && rate % content == 0) {
+                return rate;
+            }
+        }
+        return fps;
+    }
+
+    void apply_content() {  //内容帧率变化：空闲中直接切到新的最终刷新率，降频途中换用新曲线
+        int content = content_rate_.load(std::memory_order_relaxed);
+        if (content == applied_content_) {
+            return;
+        }
+        applied_content_ = content;
+        LOGD("Content rate %d", content);
+        if (inputReader.touching()) {
+            return;  //抬起时按新曲线降频
+        }
+        bool finished = decay_index_ >= curve_.size();
+        curve_ = resolve_decay();
+        if (finished) {
+            decay_index_ = curve_.size();
+            change_fps(curve_.empty() ? top_fps() : curve_.back().fps);
+        } else {
+            decay_index_ = std::min(decay_index_, curve_.size());
+        }
+    }
+
+    void on_touch_down(int count) {  //按下立即升高，按住期间不计时
+        cancel_downfps();
+        probing_.store(false, std::memory_order_relaxed);  //触摸时中止探测，下次空闲时重试
+        sampler_.setActive(false);
+        decay_index_ = curve_.size();
+        touch_pending_ = true;
+        change_fps(top_fps(), count % 15 == 0);
+        touch_pending_ = false;
+    }
+
+    void on_applied(uint64_t seq, double ms, int rc) {  //命令通道报告一条刷新率命令完成
+        applyLatency_.add(ms);
+        if (seq == touch_seq_) {
+            touch_seq_ = 0;
+            if (rc == 0) {
+                touchLatency_.add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inputReader.lastDownTime()).count());
+            }
+        }
+    }
+
+    void on_touch_up() {  //从抬起开始按曲线逐级降低
+        sampler_.setActive(true);
+        curve_ = resolve_decay();
+        decay_index_ = 0;
+        if (curve_.empty()) {
+            maybe_probe();
+            return;
+        }
+        int offset = idle_offset(inputReader.releaseVelocity(), curve_.front().ms);
+        for (auto& step : curve_) {
+            step.ms = std::max(0, step.ms + offset);
+        }
+        waitfor_downfps(curve_.front().ms);
+    }
+
+    int idle_offset(float velocity, int first_ms) const {  //按离手速度平移曲线：点击缩短，快速滑动时延长到惯性滚动结束
+        static constexpr float TAP_VELOCITY = 0.2f;          //屏幕/秒，低于此视为点击或停住后抬起
+        static constexpr float FLING_MS_PER_VELOCITY = 400.0f;
+        static constexpr int MAX_FLING_MS = 3000;
+
+        if (velocity < TAP_VELOCITY) {
+            int tap = tap_during_ms.load(std::memory_order_relaxed);
+            return (tap > 0 && tap < first_ms) ? tap - first_ms : 0;
+        }
+        return std::min(static_cast<int>(velocity * FLING_MS_PER_VELOCITY), MAX_FLING_MS);
+    }
+
+    void step_decay() {  //空闲定时器到期：切到当前一级并为下一级定时
+        if (decay_index_ >= curve_.size()) {
+            return;
+        }
+        change_fps(std::min(curve_[decay_index_].fps, top_fps()));  //曲线在锁60生效前生成时，不再升回
+        int elapsed = curve_[decay_index_].ms;
+        if (++decay_index_ < curve_.size()) {
+            waitfor_downfps(curve_[decay_index_].ms - elapsed);
+        } else {
+            maybe_probe();
+        }
+    }
+
+    std::vector<DecayStep> resolve_decay() {  //对齐到面板支持的刷新率，去掉不再降低的级
+        std::vector<DecayStep> steps;
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);
+            steps = decay_;
+        }
+        if (steps.empty()) {
+            steps.push_back({down_fps.load(std::memory_order_relaxed), down_during_ms.load(std::memory_order_relaxed)});
+        }
+
+        int last = top_fps();
+        std::vector<DecayStep> curve;
+        for (const auto& step : steps) {
+            int rate = align_content(nearestMode(std::min(step.fps, last)).first);
+            if (rate >= last) {
+                continue;
+            }
+            curve.push_back({rate, step.ms});
+            last = rate;
+        }
+        return curve;
+    }
+
     void work() {
-        fileWatcher->initialize();
+        sigset_t pipe_mask;  //命令通道的sh退出时写管道会产生SIGPIPE，在此线程中屏蔽并由通道取走
+        sigemptyset(&pipe_mask);
+        sigaddset(&pipe_mask, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe_mask, nullptr);
+
+        if (!using_backdoor.load(std::memory_order_relaxed)) {
+            resolve_keys();
+        }
+
+        bri_locked_ = lowbri.load(std::memory_order_relaxed) > currentbri.load(std::memory_order_relaxed);
+        applied_content_ = content_rate_.load(std::memory_order_relaxed);
+        if (inputReader.touching()) {
+            on_touch_down(0);
+        } else {
+            maybe_probe();
+        }
+
+        const int MAX_EVENTS = 16;
+        struct epoll_event events[MAX_EVENTS];
         int i = 0;
-        while (true) {
+        while (running_.load(std::memory_order_relaxed)) {
+            int num_events = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+            if (num_events < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOGE("DynamicFps: epoll_wait() failed: %s", strerror(errno));
+                break;
+            }
+
+            for (int n = 0; n < num_events; ++n) {
+                int fd = events[n].data.fd;
+                if (fd == wake_fd_) {
+                    uint64_t value;
+                    ssize_t result = ::read(wake_fd_, &value, sizeof(value));
+                    (void)result;
+                    if (running_.load(std::memory_order_relaxed)) {
+                        finish_probe();
+                        apply_brightness();
+                        apply_content();
+                    }
+                    continue;
+                }
+
+                if (channel.owns(fd)) {  //命令完成
+                    channel.handle();
+                    continue;
+                }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                if (fd == idle_fd_) {  //空闲到期
+                    uint64_t expirations;
+                    ssize_t result = ::read(idle_fd_, &expirations, sizeof(expirations));
+                    (void)result;
+                    idle_expirations_.fetch_add(1, std::memory_order_relaxed);
+                    if (!inputReader.touching()) {
+                        step_decay();
+                    }
+                    continue;
+                }
+
+                switch (inputReader.handle(fd)) {
+                case InputReader::Change::Down:
+                    on_touch_down(++i);
+                    break;
+                case InputReader::Change::Up:
+                    on_touch_up();
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        stop_probe();
+    }
 
-            fileWatcher->wait(-1);
-            if (!running_.load(std::memory_order_relaxed)) {
+    void resolve_keys() {  //确定需要写入的settings项：优先读取缓存，没有时留待空闲时探测，每个进程只探测一次
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);
+            if (keysProbed) {
                 return;
             }
-            if (lowbri.load(std::memory_order_relaxed) <= currentbri.load(std::memory_order_relaxed)) {
-                change_fps(up_fps.load(std::memory_order_relaxed), (++i) % 15 == 0);
+        }
+
+        std::string fp = RefreshRateProbe::fingerprint();
+        std::vector<RefreshRateProbe::Key> keys;
+        if (fp.empty() || !RefreshRateProbe::loadCache(PROBE_FILE, fp, keys)) {
+            auto tfpsmap = fpsmap.load(std::memory_order_relaxed);
+            probe_pending_ = tfpsmap && tfpsmap->size() >= 2;  //只有一种刷新率时无从判断
+            probe_fp_ = fp;
+            return;
+        }
+        use_keys(keys);
+    }
+
+    void use_keys(const std::vector<RefreshRateProbe::Key>& keys) {
+        std::lock_guard<std::mutex> lock(fpsMutex);
+        settingsKeys = keys;
+        keysProbed = true;
+        LOGI("Refresh rate control uses %zu settings key(s)", keys.size());
+    }
+
+    void maybe_probe() {  //亮屏且空闲时在后台探测；触摸、改变刷新率或熄屏时中止
+        if (!probe_pending_ || probe_thread_.joinable() || !screen_on_.load(std::memory_order_relaxed) ||
+            inputReader.touching()) {
+            return;
+        }
+        auto tfpsmap = fpsmap.load(std::memory_order_relaxed);
+        if (!tfpsmap || tfpsmap->size() < 2) {
+            return;
+        }
+        int low = tfpsmap->begin()->first;
+        int high = tfpsmap->rbegin()->first;
+
+        probing_.store(true, std::memory_order_relaxed);
+        probe_thread_ = std::thread([this, low, high, fp = probe_fp_]() {
+            LOGI("Probing refresh rate settings keys");
+            std::vector<RefreshRateProbe::Key> keys = RefreshRateProbe::probe(low, high, probing_);
+            if (probing_.exchange(false, std::memory_order_relaxed)) {  //未被中止，结果可信
+                if (keys.empty()) {
+                    LOGW("Refresh rate probe inconclusive, writing all keys");
+                }
+                if (!fp.empty()) {  //无法判断也记录，同一系统不再探测
+                    RefreshRateProbe::saveCache(PROBE_FILE, fp, keys);
+                }
+                use_keys(keys.empty() ? RefreshRateProbe::candidates() : keys);
             } else {
-                change_fps(60, (++i) % 15 == 0);  //低亮度锁60
+                LOGD("Refresh rate probe aborted, retry when idle");
             }
-            waitfor_downfps(down_during_ms.load(std::memory_order_relaxed));
+            probe_done_.store(true, std::memory_order_release);
+            wake();
+        });
+    }
+
+    void finish_probe() {  //回收探测线程，探测改动过刷新率，按当前值重新写入
+        if (!probe_done_.exchange(false, std::memory_order_acquire)) {
+            return;
+        }
+        probe_thread_.join();
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);
+            probe_pending_ = !keysProbed;
+        }
+        if (currentfps > 0) {
+            change_fps(currentfps, true);
         }
     }
 
-    void waitfor_downfps(int initialDelayMs) {
-        _target_time.store(std::chrono::steady_clock::now() +
-                               std::chrono::milliseconds(initialDelayMs),
-                           std::memory_order_relaxed);
+    void stop_probe() {  //工作线程退出前中止并等待
+        probing_.store(false, std::memory_order_relaxed);
+        if (probe_thread_.joinable()) {
+            probe_thread_.join();
+        }
+        probe_done_.store(false, std::memory_order_relaxed);
+    }
 
-        if (!_imrun.exchange(true)) {  //定时线程
-            std::thread([this]() {
-                while (std::chrono::steady_clock::now() < _target_time.load(std::memory_order_relaxed)) {
-                    std::this_thread::sleep_until(_target_time.load(std::memory_order_relaxed));
-                }
-                _imrun.store(false);
-                change_fps(down_fps.load(std::memory_order_relaxed));
-            }).detach();
+    void waitfor_downfps(int delayMs) {  //重新设定空闲定时器，只需一次系统调用
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = delayMs / 1000;
+        spec.it_value.tv_nsec = static_cast<long>(delayMs % 1000) * 1000000L;
+        if (delayMs <= 0) {
+            spec.it_value.tv_nsec = 1;  //全0会取消定时
         }
+        timerfd_settime(idle_fd_, 0, &spec, nullptr);
     }
 
-    void change_fps(int fps, bool force = false) {
-        std::lock_guard<std::mutex> lock(fpsMutex);
-        if (currentfps != fps || force) {
+    void cancel_downfps() {
+        struct itimerspec spec = {};
+        timerfd_settime(idle_fd_, 0, &spec, nullptr);
+    }
+
+    void change_fps(int fps, bool force = false) {  //仅工作线程调用
+        std::string value = std::to_string(fps);
+        std::vector<RefreshRateProbe::Key> keys;
+        {
+            std::lock_guard<std::mutex> lock(fpsMutex);  //只保护状态，提交在锁外进行
+            if (currentfps == fps && !force) {
+                return;
+            }
+            if (currentfps != fps) {
+                auto now = std::chrono::steady_clock::now();
+                if (currentfps > 0) {
+                    rate_ms_[currentfps] += std::chrono::duration<double, std::milli>(now - rate_since_).count();
+                }
+                rate_since_ = now;
+                transitions_++;
+            }
             currentfps = fps;
-            LOGD("Frame rate changed to %d", fps);
-            if (!using_backdoor.load(std::memory_order_relaxed)) {
-                execute("/system/bin/cmd", "settings", "put", "system", "peak_refresh_rate", std::to_string(fps).c_str());
-                execute("/system/bin/cmd", "settings", "put", "system", "min_refresh_rate", std::to_string(fps).c_str());
-                execute("/system/bin/cmd", "settings", "put", "system", "miui_refresh_rate", std::to_string(fps).c_str());
-                execute("/system/bin/cmd", "settings", "put", "secure", "miui_refresh_rate", std::to_string(fps).c_str());
+            current_rate.store(fps, std::memory_order_relaxed);
+            keys = settingsKeys;
+        }
+        probing_.store(false, std::memory_order_relaxed);  //探测期间改动刷新率会使结果失真，中止
+        LOGD("Frame rate changed to %d", fps);
+
+        if (!using_backdoor.load(std::memory_order_relaxed)) {
+            std::string batch;
+            for (const auto& key : keys) {
+                batch += (batch.empty() ? "" : "; ") + RefreshRateProbe::command(key, value);
+            }
+            if (channel.submit(batch)) {
+                touch_seq_ = touch_pending_ ? channel.lastSeq() : touch_seq_;
             } else {
-                int id = getFpsId(fps) - 1;
-                if (id < 0) {
-                    id = 0;
+                for (const auto& key : keys) {
+                    execute("/system/bin/cmd", "settings", "put", key.ns.c_str(), key.name.c_str(), value.c_str());
                 }
+            }
+        } else {
+            int id = getFpsId(fps) - 1;
+            if (id < 0) {
+                id = 0;
+            }
 
-                execute("/system/bin/service", "call", "SurfaceFlinger",
-                        std::to_string(backdoorid.load(std::memory_order_relaxed)).c_str(),
-                        "i32", std::to_string(id).c_str());
+            std::string code = std::to_string(backdoorid.load(std::memory_order_relaxed));
+            std::string idstr = std::to_string(id);
+            if (channel.submit("/system/bin/service call SurfaceFlinger " + code + " i32 " + idstr)) {
+                touch_seq_ = touch_pending_ ? channel.lastSeq() : touch_seq_;
+            } else {
+                execute("/system/bin/service", "call", "SurfaceFlinger", code.c_str(), "i32", idstr.c_str());
             }
         }
     }
 
     int getFpsId(int key) {  //尝试选择一个最接近的fpsid.不保证map与vector完全对应
+        return nearestMode(key).second;
+    }
+
+    std::pair<int, int> nearestMode(int key) {  //最接近的(刷新率, id)，列表为空时原样返回
         auto tfpsmap = fpsmap.load(std::memory_order_relaxed);
 
-        auto exact_it = (*tfpsmap).find(key);
-        if (exact_it != (*tfpsmap).end()) {
-            return exact_it->second;
+        if (!tfpsmap || (*tfpsmap).empty()) {
+            return {key, 0};
         }
 
-        if ((*tfpsmap).empty()) {
-            return 0;
+        auto exact_it = (*tfpsmap).find(key);
+        if (exact_it != (*tfpsmap).end()) {
+            return *exact_it;
         }
 
         auto it = (*tfpsmap).lower_bound(key);
 
         if (it == (*tfpsmap).end()) {
-            return (*tfpsmap).rbegin()->second;
+            return *(*tfpsmap).rbegin();
         }
 
         if (it == (*tfpsmap).begin()) {
 
-            return it->second;
+            return *it;
         }
         auto prev_it = std::prev(it);
 
         int diff_prev = std::abs(key - prev_it->first);
         int diff_next = std::abs(it->first - key);
-        return (diff_prev <= diff_next) ? prev_it->second : it->second;
+        return (diff_prev <= diff_next) ? *prev_it : *it;
     }
 
     template <typename... Args>
-    void execute(Args&&... args) {
-        std::vector<const char*> argv = {std::forward<Args>(args)..., nullptr};
+    void execute(Args&&... args) {  //不等待，由ChildSupervisor回收并统计
+        ChildSupervisor::instance().spawn({std::forward<Args>(args)...});
+    }
 
-        pid_t pid = fork();
-        if (pid == 0) {
-            execv(argv[0], const_cast<char* const*>(argv.data()));
-            _exit(127);
-        } else if (pid > 0) {
-            waitpid(pid, nullptr, WNOHANG);
+public:
+    static int parseRate(const char* str) {  //解析刷新率，接近整数时取整
+        char* end = nullptr;
+        double fps = strtod(str, &end);
+        if (end == str || fps < 1.0 || fps > 512.0) {
+            return 0;
         }
+        int rounded = static_cast<int>(std::lround(fps));
+        return std::abs(fps - rounded) < 0.01 ? rounded : static_cast<int>(fps);
     }
 
-public:
-    static std::vector<int> getAvailableRefreshRates() {  //获取所有可用的刷新率
+    static DisplayModes parseDisplayModes(const std::string& output) {  //一次遍历得到分辨率表与刷新率列表
+        DisplayModes modes;
         std::set<int> rates;
 
-        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("dumpsys display | grep DisplayModeRecord", "r"), pclose);
-        if (!pipe) return {};
-
-        std::string output;
-        char buffer[256];
-        while (fgets(buffer, sizeof(buffer), pipe.get())) output += buffer;
-
-        auto parseRate = [](const std::string& str) -> int {
-            std::string cleanStr = str;
-            cleanStr.erase(0, cleanStr.find_first_not_of(" \t\r\n"));
-            cleanStr.erase(cleanStr.find_last_not_of(" \t\r\n") + 1);
-
-            if (cleanStr.empty()) {
-                return 0;
+        size_t pos = 0;
+        while ((pos = output.find("DisplayModeRecord", pos)) != std::string::npos) {
+            size_t end = output.find('\n', pos);
+            if (end == std::string::npos) {
+                end = output.size();
             }
-
-            try {
-                double fps = std::stod(cleanStr);
-                int rounded = std::round(fps);
-                if (fps < 1.0 || fps > 512.0) {
-                    return 0;
-                }
-                return std::abs(fps - rounded) < 0.01 ? rounded : static_cast<int>(fps);
-            } catch (...) {
-                return 0;
+            auto field = [&](const char* key) -> const char* {  //本条记录内key=之后的位置
+                size_t at = output.find(key, pos);
+                return (at != std::string::npos && at < end) ? output.c_str() + at + strlen(key) : nullptr;
+            };
+
+            const char* idStr = field("id=");
+            const char* widthStr = field("width=");
+            const char* heightStr = field("height=");
+            const char* fpsStr = field("fps=");
+            int id = idStr ? atoi(idStr) : 0;
+            int width = widthStr ? atoi(widthStr) : 0;
+            int height = heightStr ? atoi(heightStr) : 0;
+            int fps = fpsStr ? parseRate(fpsStr) : 0;
+
+            if (fps > 0) {
+                rates.insert(fps);
+            }
+            if (id > 0 && width > 0 && height > 0 && fps > 0) {
+                std::string resolution = std::to_string(width) + "x" + std::to_string(height);
+                modes.byResolution[resolution][fps] = id;
+                LOGD("Found: %s,%d,%d", resolution.c_str(), fps, id);
             }
-        };
 
-        size_t pos = 0;
-        while (pos < output.size()) {
-            if (auto fpsPos = output.find("fps=", pos); fpsPos != std::string::npos) {  //fps
-                auto start = fpsPos + 4;
-                auto end = output.find_first_of(",}", start);
-                if (end != std::string::npos) {
-                    std::string rateStr = output.substr(start, end - start);
-                    if (int rate = parseRate(rateStr); rate > 0) {
+            if (const char* alt = field("alternativeRefreshRates=[")) {
+                const char* close = strchr(alt, ']');
+                while (close && alt < close) {
+                    if (int rate = parseRate(alt); rate > 0) {
                         rates.insert(rate);
                     }
-                }
-                pos = fpsPos + 1;
-            } else if (auto altPos = output.find("alternativeRefreshRates=[", pos); altPos != std::string::npos) {  // alternativeRefreshRates
-                auto start = altPos + 26;
-                auto end = output.find("]", start);
-                if (end != std::string::npos) {
-                    std::string altList = output.substr(start, end - start);
-                    std::istringstream iss(altList);
-                    std::string token;
-
-                    while (std::getline(iss, token, ',')) {
-                        if (int rate = parseRate(token); rate > 0) {
-                            rates.insert(rate);
-                        }
+                    alt = strchr(alt, ',');
+                    if (!alt || alt > close) {
+                        break;
                     }
+                    ++alt;
                 }
-                pos = altPos + 1;
-            } else {
-                break;
             }
+            pos = end;
         }
 
-        std::vector<int> result;
         for (int rate : rates) {
             if (rate >= 10 && rate <= 512) {
-                result.push_back(rate);
+                modes.rates.push_back(rate);
             }
         }
-
-        std::sort(result.begin(), result.end());
-        return result;
+        return modes;
     }
 
     /*可能的内容：
@@ -317,104 +880,65 @@ public:
 
     */
 
-    static std::unordered_map<std::string, std::map<int, int>> getResolutionToDisplayModes() {  //解析所有显示模式
-        std::unordered_map<std::string, std::map<int, int>> resolutionModes;
-
-        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("dumpsys display | grep DisplayModeRecord", "r"), pclose);
-        if (!pipe) return {};
-
-        std::string output;
+    static std::string displayKey() {  //物理显示器的id，比完整的dumpsys display轻得多
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("dumpsys SurfaceFlinger --display-id", "r"), pclose);
+        if (!pipe) {
+            return "";
+        }
+        std::string key;
         char buffer[256];
-        while (fgets(buffer, sizeof(buffer), pipe.get())) output += buffer;
-
-        auto parseFps = [](const std::string& str) -> int {
-            std::string cleanStr = str;
-            cleanStr.erase(0, cleanStr.find_first_not_of(" \t\r\n"));
-            cleanStr.erase(cleanStr.find_last_not_of(" \t\r\n") + 1);
-
-            if (cleanStr.empty()) {
-                return 0;
-            }
-
-            try {
-                double fps = std::stod(cleanStr);
-                int rounded = std::round(fps);
-                if (fps < 1.0 || fps > 512.0) {
-                    return 0;
-                }
-                return std::abs(fps - rounded) < 0.01 ? rounded : static_cast<int>(fps);
-            } catch (...) {
-                return 0;
-            }
-        };
-
-        std::istringstream iss(output);
-        std::string line;
-
-        while (std::getline(iss, line)) {
-            if (line.find("DisplayModeRecord") == std::string::npos) {
-                continue;
-            }
-
-            int id = 0, width = 0, height = 0, fps = 0;
-
-            auto idPos = line.find("id=");
-            if (idPos != std::string::npos) {
-                auto idStart = idPos + 3;
-                auto idEnd = line.find_first_of(", ", idStart);
-                if (idEnd != std::string::npos) {
-                    try {
-                        id = std::stoi(line.substr(idStart, idEnd - idStart));
-                    } catch (...) {
-                        continue;
-                    }
-                }
-            }
-
-            auto widthPos = line.find("width=");
-            if (widthPos != std::string::npos) {
-                auto widthStart = widthPos + 6;
-                auto widthEnd = line.find_first_of(", ", widthStart);
-                if (widthEnd != std::string::npos) {
-                    try {
-                        width = std::stoi(line.substr(widthStart, widthEnd - widthStart));
-                    } catch (...) {
-                        continue;
-                    }
-                }
+        for (int lines = 0; lines < 64 && fgets(buffer, sizeof(buffer), pipe.get()); ++lines) {  //不支持该参数时会输出完整内容，只看开头
+            unsigned long long id = 0;
+            if (sscanf(buffer, "Display %llu", &id) == 1) {
+                key += (key.empty() ? "" : ",") + std::to_string(id);
             }
+        }
+        return key;
+    }
 
-            auto heightPos = line.find("height=");
-            if (heightPos != std::string::npos) {
-                auto heightStart = heightPos + 7;
-                auto heightEnd = line.find_first_of(", ", heightStart);
-                if (heightEnd != std::string::npos) {
-                    try {
-                        height = std::stoi(line.substr(heightStart, heightEnd - heightStart));
-                    } catch (...) {
-                        continue;
+    static DisplayModes loadDisplayModes() {  //按系统指纹与显示器id缓存，未变化时不再解析dumpsys display
+        std::string fp = RefreshRateProbe::fingerprint();
+        std::string display = displayKey();
+        bool cacheable = !fp.empty() && !display.empty();
+
+        if (cacheable) {
+            std::ifstream file(MODES_FILE);
+            if (file.is_open()) {
+                try {
+                    nlohmann::json data = nlohmann::json::parse(file);
+                    if (data.value("fingerprint", "") == fp && data.value("display", "") == display) {
+                        DisplayModes modes;
+                        for (const auto& [resolution, list] : data["modes"].items()) {
+                            for (const auto& [fps, id] : list.items()) {
+                                modes.byResolution[resolution][std::stoi(fps)] = id.get<int>();
+                            }
+                        }
+                        modes.rates = data["rates"].get<std::vector<int>>();
+                        if (!modes.byResolution.empty()) {
+                            LOGD("Display modes loaded from %s", MODES_FILE);
+                            return modes;
+                        }
                     }
+                } catch (const std::exception& e) {
+                    LOGW("Failed to load %s: %s", MODES_FILE, e.what());
                 }
             }
+        }
 
-            auto fpsPos = line.find("fps=");
-            if (fpsPos != std::string::npos) {  // 解析fps
-                auto fpsStart = fpsPos + 4;
-                auto fpsEnd = line.find_first_of(",}", fpsStart);
-                if (fpsEnd != std::string::npos) {
-                    std::string fpsStr = line.substr(fpsStart, fpsEnd - fpsStart);
-                    fps = parseFps(fpsStr);
+        DisplayModes modes = parseDisplayModes(RefreshRateProbe::run("dumpsys display | grep DisplayModeRecord"));
+        if (cacheable && !modes.byResolution.empty()) {
+            nlohmann::json list = nlohmann::json::object();
+            for (const auto& [resolution, fpsIds] : modes.byResolution) {
+                for (const auto& [fps, id] : fpsIds) {
+                    list[resolution][std::to_string(fps)] = id;
                 }
             }
-
-            if (id > 0 && width > 0 && height > 0 && fps > 0) {
-                std::string resolution = std::to_string(width) + "x" + std::to_string(height);
-                resolutionModes[resolution][fps] = id;
-                LOGD("Found: %s,%d,%d", resolution.c_str(), fps, id);
+            std::ofstream file(MODES_FILE, std::ios::trunc);
+            if (file.is_open()) {
+                file << nlohmann::json{{"fingerprint", fp}, {"display", display}, {"modes", list}, {"rates", modes.rates}}.dump(4);
             }
         }
-
-        return resolutionModes;
+        return modes;
     }
 
     static std::pair<int, int> parseResolution(const std::string& resolution_str) {  //从hxw字符串解析出h和w
@@ -0,0 +1,191 @@
+/*记录每次模式切换的耗时与执行结果*/
+/*按切换对(from->to)聚合，便于找出慢或失败的调度脚本*/
+#ifndef MODE_PROFILER_HPP
+#define MODE_PROFILER_HPP
+
+#include "JSONSocket/JSONSocket.hpp"
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+struct ModeSwitchRecord {  //单次切换
+    std::string from;
+    std::string to;
+    std::string app;
+    double duration_ms = 0.0;
+    int exit_code = 0;
+    std::string output;  //截断后的stdout/stderr
+    time_t timestamp = 0;
+};
+
+struct TransitionStats {  //同一切换对的聚合
+    unsigned int count = 0;
+    unsigned int failures = 0;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+    double last_ms = 0.0;
+    int last_exit = 0;
+    std::string last_error;  //最近一次失败的输出
+};
+
+struct ThrottleStats {  //某应用触发的限流
+    unsigned int count = 0;
+    std::string last_from;
+    std::string last_to;
+    time_t last_time = 0;
+};
+
+class ModeProfilerTarget : public ConfigTarget {
+public:
+    static constexpr size_t MAX_OUTPUT = 1024;  //单次保留的输出上限
+    static constexpr size_t MAX_RECENT = 32;    //保留的最近记录数
+
+private:
+    std::map<std::pair<std::string, std::string>, TransitionStats> transitions_;
+    std::deque<ModeSwitchRecord> recent_;
+    std::map<std::string, ThrottleStats> throttled_;
+    mutable std::mutex dataMutex_;
+
+    /*脚本输出不一定是UTF-8，且可能在多字节字符中间被截断，原样存入会使dump()抛出异常
+      在字符边界上截断到MAX_OUTPUT，非法字节换成U+FFFD，末尾不完整的字符直接丢弃*/
+    static std::string clean_output(const std::string& raw) {
+        static const char REPLACEMENT[] = "\xEF\xBF\xBD";
+        static const uint32_t MIN_CODE[] = {0, 0, 0x80, 0x800, 0x10000};  //按长度的最小码点，更小即为过长编码
+
+        std::string out;
+        size_t i = 0;
+        while (i < raw.size()) {
+            unsigned char lead = static_cast<unsigned char>(raw[i]);
+            size_t len = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+
+            bool valid = len > 0;
+            size_t k = 1;
+            for (; valid && k < len && i + k < raw.size(); ++k) {
+                valid = (static_cast<unsigned char>(raw[i + k]) & 0xC0) == 0x80;
+            }
+            if (valid && i + len > raw.size()) {  //截断处的半个字符
+                break;
+            }
+            if (valid && len > 1) {
+                uint32_t code = lead & (0x7F >> len);
+                for (k = 1; k < len; ++k) {
+                    code = (code << 6) | (static_cast<unsigned char>(raw[i + k]) & 0x3F);
+                }
+                valid = code >= MIN_CODE[len] && code <= 0x10FFFF && (code < 0xD800 || code > 0xDFFF);
+            }
+
+            const char* piece = valid ? raw.data() + i : REPLACEMENT;
+            size_t size = valid ? len : sizeof(REPLACEMENT) - 1;
+            if (out.size() + size > MAX_OUTPUT) {
+                break;
+            }
+            out.append(piece, size);
+            i += valid ? len : 1;
+        }
+        return out;
+    }
+
+public:
+    std::string getName() const override {
+        return "modeProfile";
+    }
+
+    nlohmann::json read() override {
+        std::lock_guard<std::mutex> lock(dataMutex_);
+        nlohmann::json result;
+
+        nlohmann::json transitions = nlohmann::json::array();
+        for (const auto& [key, stats] : transitions_) {
+            nlohmann::json item;
+            item["from"] = key.first;
+            item["to"] = key.second;
+            item["count"] = stats.count;
+            item["failures"] = stats.failures;
+            item["avg_ms"] = stats.count ? stats.total_ms / stats.count : 0.0;
+            item["max_ms"] = stats.max_ms;
+            item["last_ms"] = stats.last_ms;
+            item["last_exit"] = stats.last_exit;
+            item["last_error"] = stats.last_error;
+            transitions.push_back(std::move(item));
+        }
+        result["transitions"] = transitions;
+
+        nlohmann::json recent = nlohmann::json::array();
+        for (const auto& record : recent_) {
+            nlohmann::json item;
+            item["from"] = record.from;
+            item["to"] = record.to;
+            item["app"] = record.app;
+            item["duration_ms"] = record.duration_ms;
+            item["exit_code"] = record.exit_code;
+            item["output"] = record.output;
+            item["timestamp"] = record.timestamp;
+            recent.push_back(std::move(item));
+        }
+        result["recent"] = recent;
+
+        nlohmann::json throttled = nlohmann::json::array();
+        for (const auto& [app, stats] : throttled_) {
+            nlohmann::json item;
+            item["app"] = app;
+            item["count"] = stats.count;
+            item["last_from"] = stats.last_from;
+            item["last_to"] = stats.last_to;
+            item["last_time"] = stats.last_time;
+            throttled.push_back(std::move(item));
+        }
+        result["throttled"] = throttled;
+
+        return result;
+    }
+
+    nlohmann::json write(const nlohmann::json& data) override {
+        return {{"status", "error"}, {"message", "modeProfile target is read-only"}};
+    }
+
+    void record(ModeSwitchRecord record) {
+        record.output = clean_output(record.output);
+        record.timestamp = time(nullptr);
+
+        std::lock_guard<std::mutex> lock(dataMutex_);
+        TransitionStats& stats = transitions_[{record.from, record.to}];
+        stats.count++;
+        stats.total_ms += record.duration_ms;
+        stats.last_ms = record.duration_ms;
+        stats.last_exit = record.exit_code;
+        if (record.duration_ms > stats.max_ms) {
+            stats.max_ms = record.duration_ms;
+        }
+        if (record.exit_code != 0) {
+            stats.failures++;
+            stats.last_error = record.output;
+        }
+
+        recent_.push_back(std::move(record));
+        if (recent_.size() > MAX_RECENT) {
+            recent_.pop_front();
+        }
+    }
+
+    void recordThrottle(const std::string& app, const std::string& from, const std::string& to) {  //记录一次被限流的切换
+        std::lock_guard<std::mutex> lock(dataMutex_);
+        ThrottleStats& stats = throttled_[app.empty() ? "_unknown_" : app];
+        stats.count++;
+        stats.last_from = from;
+        stats.last_to = to;
+        stats.last_time = time(nullptr);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(dataMutex_);
+        transitions_.clear();
+        recent_.clear();
+        throttled_.clear();
+    }
+};
+
+#endif
@@ -4,35 +4,61 @@
 #define POWER_MONITOR_MODULE_HPP
 
 #include "JSONSocket/JSONSocket.hpp"
+#include "energytable.hpp"
+#include "powerlog.hpp"
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstring>
 #include <ctime>
 #include <fcntl.h>
 #include <fstream>
+#include <map>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
-
-// 应用功耗记录结构体
-struct AppPower {
-    float time_sec = 0.0f;      // 应用运行时间（秒）
-    float power_joules = 0.0f;  // 焦耳累计
-};
+#include <vector>
 
 class PowerMonitorTarget : public ConfigTarget {  //主管功耗监控
 private:
-    // 功耗数据存储
-    std::unordered_map<std::string, AppPower> app_power_map_;
+    // 功耗数据存储：主循环把前台包名换成编号，采样时按编号直接写入定长数组，不分配也不哈希字符串
+    static constexpr int MAX_APPS = 1024;  //编号用尽后的应用计入_other_
+    static constexpr int OTHER_ID = 0;
+    std::vector<std::string> app_names_{"_other_"};          //编号 -> 包名，只增不减
+    std::unordered_map<std::string, int> app_ids_{{"_other_", OTHER_ID}};  //包名 -> 编号
+    std::vector<AppPower> app_power_ = std::vector<AppPower>(MAX_APPS);  //按编号的累计值
+    std::vector<AppPower> pending_ = std::vector<AppPower>(MAX_APPS);    //尚未追加的增量
+    std::atomic<int> current_app_{-1};  //前台应用编号，-1为未知
     mutable std::mutex data_mutex_;
 
+    // 按(应用, 模式, 刷新率, 状态)细分的能耗，模式同样换成编号
+    enum PowerState : uint8_t {
+        SCREEN_ON = 0,   //亮屏使用电池
+        CHARGING = 1,    //亮屏充电，只记时间
+        SCREEN_OFF = 2,  //熄屏待机，由电量计在亮屏时一次计入
+    };
+    static constexpr const char* STATE_NAMES[] = {"screen_on", "charging", "screen_off"};
+    static constexpr int MAX_MODES = 256;
+    static constexpr const char* STANDBY_APP = "_standby_";  //熄屏能耗不归属任何应用
+    static constexpr char BUCKET_PREFIX = '@';  //记录中细分项的名字为"@包名|模式|刷新率|状态"，包名不含'@'与'|'
+    EnergyTable buckets_;
+    std::vector<std::string> mode_names_{""};  //编号0为未知
+    std::unordered_map<std::string, int> mode_ids_{{"", 0}};
+    std::atomic<int> current_mode_{0};
+    const std::atomic<int>* rate_source_ = nullptr;  //动态刷新率当前设定的刷新率
+
+    // 熄屏期间不采样，亮屏后按电量计的差值补记
+    long standby_charge_ = -1;
+    timespec standby_start_{};
+
     // 传感器文件描述符
     int current_fd_ = -1;
     int voltage_fd_ = -1;
     int status_fd_ = -1;
+    int charge_fd_ = -1;
 
     bool* dualBatteryPtr_;
     std::atomic<int> unit_{12};
@@ -44,20 +70,22 @@ private:
     std::mutex control_mutex_;
     std::condition_variable cv_;
 
-    const std::string* current_app_ptr_;
-
     std::atomic<bool> screen_status{true};
 
     // 日志记录
     int loop_counter_ = 0;
-    const int LOG_INTERVAL = 300;
-    const std::string LOG_FILE = "./powerlog.json";
+    const int APPEND_INTERVAL = 30;       //每30次采样追加一次增量
+    const int CHECKPOINT_INTERVAL = 1800;  //每1800次采样写一次检查点
+    const std::string LOG_FILE = "./powerlog.bin";
+    const std::string LEGACY_LOG_FILE = "./powerlog.json";  //旧版本的记录，只在没有LOG_FILE时导入一次
+    PowerLog power_log_{LOG_FILE};
 
     // 初始化传感器
     bool init_power_sensors() {
         current_fd_ = open("/sys/class/power_supply/battery/current_now", O_RDONLY | O_CLOEXEC);
         voltage_fd_ = open("/sys/class/power_supply/battery/voltage_now", O_RDONLY | O_CLOEXEC);
         status_fd_ = open("/sys/class/power_supply/battery/status", O_RDONLY | O_CLOEXEC);
+        charge_fd_ = open("/sys/class/power_supply/battery/charge_counter", O_RDONLY | O_CLOEXEC);  //只用于熄屏统计
         return (current_fd_ >= 0) && (voltage_fd_ >= 0);  //status一般不是必须的
     }
 
@@ -82,12 +110,208 @@ private:
                ((*dualBatteryPtr_) ? 2.0 : 1.0);                                             //双电芯
     }
 
+    // 以下需持有data_mutex_
+    int intern(const std::string& name) {  //取得包名的编号，首次出现时分配
+        auto it = app_ids_.find(name);
+        if (it != app_ids_.end()) {
+            return it->second;
+        }
+        if (app_names_.size() >= MAX_APPS) {
+            return OTHER_ID;
+        }
+        int id = static_cast<int>(app_names_.size());
+        app_names_.push_back(name);
+        app_ids_.emplace(name, id);
+        return id;
+    }
+
+    int intern_mode(const std::string& name) {
+        auto it = mode_ids_.find(name);
+        if (it != mode_ids_.end()) {
+            return it->second;
+        }
+        if (mode_names_.size() >= MAX_MODES) {
+            return 0;
+        }
+        int id = static_cast<int>(mode_names_.size());
+        mode_names_.push_back(name);
+        mode_ids_.emplace(name, id);
+        return id;
+    }
+
+    void add_bucket(int app, int fps, PowerState state, float time_sec, float joules) {  //表满时新的组合并入_other_
+        EnergyTable::Key key;
+        key.app = static_cast<uint16_t>(app);
+        key.mode = static_cast<uint8_t>(current_mode_.load(std::memory_order_relaxed));
+        key.fps = static_cast<uint16_t>(std::max(0, std::min(fps, 0xFFFF)));
+        key.state = state;
+        EnergyTable::Entry* entry = buckets_.find(key, EnergyTable::SOFT_LIMIT);
+        if (!entry) {
+            key.app = OTHER_ID;
+            entry = buckets_.find(key);
+        }
+        if (!entry) {
+            return;
+        }
+        for (AppPower* stats : {&entry->total, &entry->pending}) {
+            stats->time_sec += time_sec;
+            stats->power_joules += joules;
+        }
+    }
+
+    void export_buckets(PowerLog::PowerMap& map, bool pending) {  //按名字导出细分项
+        buckets_.forEach([&](const EnergyTable::Key& key, EnergyTable::Entry& entry) {
+            const AppPower& stats = pending ? entry.pending : entry.total;
+            if (has_data(stats) && key.app < app_names_.size() && key.mode < mode_names_.size() && key.state <= SCREEN_OFF) {
+                map[BUCKET_PREFIX + app_names_[key.app] + "|" + mode_names_[key.mode] + "|" + std::to_string(key.fps) + "|" +
+                    STATE_NAMES[key.state]] = stats;
+            }
+        });
+    }
+
+    bool import_bucket(const std::string& name, const AppPower& stats) {  //"@包名|模式|刷新率|状态"，模式可能含'|'，从两端拆分
+        size_t first = name.find('|');
+        size_t last = name.rfind('|');
+        size_t middle = last == std::string::npos || last == 0 ? std::string::npos : name.rfind('|', last - 1);
+        if (name.empty() || name[0] != BUCKET_PREFIX || first == std::string::npos || middle == std::string::npos || middle <= first) {
+            return false;
+        }
+        int state = -1;
+        for (int i = SCREEN_ON; i <= SCREEN_OFF; ++i) {
+            state = name.compare(last + 1, std::string::npos, STATE_NAMES[i]) == 0 ? i : state;
+        }
+        if (state < 0) {
+            return false;
+        }
+        EnergyTable::Key key;
+        key.app = static_cast<uint16_t>(intern(name.substr(1, first - 1)));
+        key.mode = static_cast<uint8_t>(intern_mode(name.substr(first + 1, middle - first - 1)));
+        key.fps = static_cast<uint16_t>(atoi(name.c_str() + middle + 1));
+        key.state = static_cast<uint8_t>(state);
+        EnergyTable::Entry* entry = buckets_.find(key);
+        if (!entry) {
+            return false;
+        }
+        entry->total.time_sec += stats.time_sec;
+        entry->total.power_joules += stats.power_joules;
+        return true;
+    }
+
+    void clear_pending() {
+        std::fill(pending_.begin(), pending_.end(), AppPower{});
+        buckets_.forEach([](const EnergyTable::Key&, EnergyTable::Entry& entry) { entry.pending = AppPower{}; });
+    }
+
+    void scale_joules(float factor) {  //单位矫正
+        for (size_t id = 0; id < app_names_.size(); ++id) {
+            app_power_[id].power_joules *= factor;
+        }
+        buckets_.forEach([factor](const EnergyTable::Key&, EnergyTable::Entry& entry) { entry.total.power_joules *= factor; });
+    }
+
+    static bool has_data(const AppPower& stats) {
+        return stats.time_sec > 0.0f || stats.power_joules > 0.0f;
+    }
+
+    size_t app_count() const {
+        size_t count = 0;
+        for (size_t id = 0; id < app_names_.size(); ++id) {
+            count += has_data(app_power_[id]) ? 1 : 0;
+        }
+        return count;
+    }
+
+    PowerLog::PowerMap snapshot(const std::vector<AppPower>& values) const {  //按包名导出有数据的项
+        PowerLog::PowerMap map;
+        for (size_t id = 0; id < app_names_.size(); ++id) {
+            if (has_data(values[id])) {
+                map[app_names_[id]] = values[id];
+            }
+        }
+        return map;
+    }
+
+    void restore(const PowerLog::PowerMap& map) {  //载入记录，覆盖现有数据
+        std::fill(app_power_.begin(), app_power_.end(), AppPower{});
+        std::fill(pending_.begin(), pending_.end(), AppPower{});
+        buckets_.clear();
+        for (const auto& [name, stats] : map) {
+            if (!name.empty() && name[0] == BUCKET_PREFIX) {
+                if (!import_bucket(name, stats)) {
+                    LOGW("PowerMonitor: dropped power record %s", name.c_str());
+                }
+                continue;
+            }
+            AppPower& slot = app_power_[intern(name)];
+            slot.time_sec += stats.time_sec;
+            slot.power_joules += stats.power_joules;
+        }
+    }
+
+    long read_sensor(int fd) {  //读取整数，失败返回-1
+        char buf[32] = {0};
+        if (fd < 0 || pread(fd, buf, sizeof(buf) - 1, 0) <= 0) {
+            return -1;
+        }
+        return atol(buf);
+    }
+
+    void begin_standby() {  //熄屏时记下电量计读数，挂起期间也要计时
+        standby_charge_ = read_sensor(charge_fd_);
+        clock_gettime(CLOCK_BOOTTIME, &standby_start_);
+    }
+
+    void end_standby() {  //亮屏时电量计减少的部分乘以电压即为熄屏期间的能耗，期间充过电则放弃
+        long start_uah = standby_charge_;
+        standby_charge_ = -1;
+        long charge_uah = read_sensor(charge_fd_);
+        char battery_status = 0;
+        pread(status_fd_, &battery_status, 1, 0);
+        if (start_uah <= 0 || charge_uah < 0 || charge_uah >= start_uah || battery_status == 'C' || battery_status == 'F') {
+            return;
+        }
+
+        timespec now;
+        clock_gettime(CLOCK_BOOTTIME, &now);
+        float seconds = static_cast<float>(now.tv_sec - standby_start_.tv_sec) +
+                        static_cast<float>(static_cast<double>(now.tv_nsec - standby_start_.tv_nsec) * 1e-9);
+        long voltage_uv = read_sensor(voltage_fd_);
+        if (seconds < 60.0f || voltage_uv <= 0) {  //太短时电量计的精度不够
+            return;
+        }
+
+        float joules = static_cast<float>(static_cast<double>(start_uah - charge_uah) *
+                                          static_cast<double>(voltage_uv) *
+                                          std::pow(10.0, -unit_.load(std::memory_order_relaxed)) * 3600.0) *  //Wh转换到J
+                       ((*dualBatteryPtr_) ? 2.0f : 1.0f);
+        std::lock_guard<std::mutex> lock(data_mutex_);
+        add_bucket(intern(STANDBY_APP), 0, SCREEN_OFF, seconds, joules);
+        LOGD("PowerMonitor: %.0fs screen off, %.1fJ", seconds, joules);
+    }
+
     // 加载记录
     void load_log_file() {
-        std::ifstream file(LOG_FILE);
+        int unit = unit_.load(std::memory_order_relaxed);
+        PowerLog::PowerMap map;
+        std::lock_guard<std::mutex> lock(data_mutex_);
+        if (power_log_.load(map, unit)) {
+            unit_.store(unit, std::memory_order_relaxed);
+            restore(map);
+            LOGD("Loaded power log from %s", LOG_FILE.c_str());
+            return;
+        }
+
+        if (load_legacy_log_file(map)) {
+            restore(map);
+            power_log_.checkpoint(map, unit_.load(std::memory_order_relaxed));  //导入后立即写入新格式
+        }
+    }
+
+    bool load_legacy_log_file(PowerLog::PowerMap& map) {
+        std::ifstream file(LEGACY_LOG_FILE);
         if (!file.is_open()) {
             LOGD("Power log file not found, will create new one");
-            return;
+            return false;
         }
 
         try {
@@ -105,59 +329,54 @@ private:
             }
 
             if (mdata.is_array()) {
-                std::lock_guard<std::mutex> lock(data_mutex_);
                 for (const auto& entry : mdata) {
                     if (entry.contains("name") && entry.contains("time_sec") && entry.contains("power_joules")) {
                         std::string name = entry["name"].get<std::string>();
                         AppPower stats;
                         stats.time_sec = entry["time_sec"].get<float>();
                         stats.power_joules = entry["power_joules"].get<float>();
-                        app_power_map_[name] = stats;
+                        map[name] = stats;
                     }
                 }
-                LOGD("Loaded power log from %s", LOG_FILE.c_str());
+                LOGD("Imported power log from %s", LEGACY_LOG_FILE.c_str());
+                return !map.empty();
             }
         } catch (const std::exception& e) {
             LOGW("Failed to parse power log file: %s", e.what());
         }
+        return false;
     }
 
-    // 保存日志
-    void save_log_file() {
-        nlohmann::json log_array = nlohmann::json::array();
-
-        for (const auto& [name, stats] : app_power_map_) {
-            nlohmann::json entry;
-            entry["name"] = name;
-            entry["time_sec"] = stats.time_sec;
-            entry["power_joules"] = stats.power_joules;
-            log_array.push_back(entry);
+    // 保存日志：追加增量，需持有data_mutex_
+    void append_log() {
+        PowerLog::PowerMap deltas = snapshot(pending_);
+        export_buckets(deltas, true);
+        if (!power_log_.append(deltas)) {
+            save_log_file();
+            return;
         }
+        clear_pending();
+    }
 
-        nlohmann::json logdata = nlohmann::json::object();
-
-        logdata["unit"]=unit_.load(std::memory_order_relaxed);
-
-        logdata["data"]= log_array;
-
-        try {
-            std::ofstream file(LOG_FILE, std::ios::trunc);
-            if (file.is_open()) {
-                file << logdata.dump(4); 
-                LOGD("Saved power log to %s", LOG_FILE.c_str());
-            } else {
-                LOGW("Failed to open power log file for writing");
-            }
-        } catch (const std::exception& e) {
-            LOGW("Failed to save power log: %s", e.what());
+    // 写入检查点，需持有data_mutex_
+    void save_log_file() {
+        PowerLog::PowerMap totals = snapshot(app_power_);
+        export_buckets(totals, false);
+        if (power_log_.checkpoint(totals, unit_.load(std::memory_order_relaxed))) {
+            clear_pending();  //已包含在检查点中
+            LOGD("Saved power log to %s", LOG_FILE.c_str());
+        } else {
+            LOGW("Failed to save power log");
         }
     }
 
     // 检查-记录
     void check_and_log() {
-        if (++loop_counter_ >= LOG_INTERVAL) {
+        if (++loop_counter_ >= CHECKPOINT_INTERVAL) {
             loop_counter_ = 0;
             save_log_file();
+        } else if (loop_counter_ % APPEND_INTERVAL == 0) {
+            append_log();
         }
     }
 
@@ -177,6 +396,10 @@ private:
                 close(status_fd_);
                 status_fd_ = -1;
             }
+            if (charge_fd_ >= 0) {
+                close(charge_fd_);
+                charge_fd_ = -1;
+            }
             running_.store(false, std::memory_order_relaxed);
             return;
         }
@@ -201,6 +424,9 @@ private:
                         return ((!running_.load(std::memory_order_relaxed)) || (!stop_.load(std::memory_order_relaxed)));
                     });
                     LOGD("Screen On,Power Monitor Continue");
+                    if (running_.load(std::memory_order_relaxed)) {
+                        end_standby();
+                    }
                     clock_gettime(CLOCK_MONOTONIC, &last_time);
                 } else {
                     cv_.wait_for(lock, std::chrono::seconds(1), [this]() {
@@ -214,21 +440,33 @@ private:
             }
 
             if (!screen_status.load(std::memory_order_relaxed)) {  //熄屏时
-                stop_.store(true, std::memory_order_relaxed);      //准备自我阻塞
+                std::lock_guard<std::mutex> lock(control_mutex_);
+                if (!screen_status.load(std::memory_order_relaxed)) {  //加锁后再确认，期间亮屏则继续采样
+                    stop_.store(true, std::memory_order_relaxed);      //准备自我阻塞
+                    begin_standby();
+                }
                 continue;
             }
 
-            std::string app_name = *current_app_ptr_;
+            int app_id = current_app_.load(std::memory_order_acquire);
 
-            if (app_name.empty()) {
+            if (app_id < 0) {
                 clock_gettime(CLOCK_MONOTONIC, &last_time);  //重置时间
                 continue;
             }
 
+            int fps = rate_source_ ? rate_source_->load(std::memory_order_relaxed) : 0;
+
             pread(status_fd_, &battery_status, 1, 0);
 
-            if (battery_status == 'C' || battery_status == 'F') {  //充电时不统计
-                clock_gettime(CLOCK_MONOTONIC, &last_time);
+            if (battery_status == 'C' || battery_status == 'F') {  //充电时功率无意义，只在细分项中记录时间
+                clock_gettime(CLOCK_MONOTONIC, &current_time);
+                delta_t = static_cast<float>(current_time.tv_sec - last_time.tv_sec) +
+                          static_cast<float>(static_cast<double>(current_time.tv_nsec - last_time.tv_nsec) * 1e-9);
+                last_time = current_time;
+                std::lock_guard<std::mutex> lock(data_mutex_);
+                add_bucket(app_id, fps, CHARGING, delta_t, 0.0f);
+                check_and_log();
                 continue;
             }
 
@@ -247,9 +485,13 @@ private:
 
             {
                 std::lock_guard<std::mutex> lock(data_mutex_);  //填入内存
-                AppPower& stats = app_power_map_[app_name];
+                AppPower& stats = app_power_[app_id];
                 stats.time_sec += delta_t;
                 stats.power_joules += (power_w * delta_t);
+                AppPower& delta = pending_[app_id];
+                delta.time_sec += delta_t;
+                delta.power_joules += (power_w * delta_t);
+                add_bucket(app_id, fps, SCREEN_ON, delta_t, power_w * delta_t);
 
                 // 检查是否需要记录日志
                 check_and_log();
@@ -257,7 +499,10 @@ private:
         }
 
         // 退出前保存日志
-        save_log_file();
+        {
+            std::lock_guard<std::mutex> lock(data_mutex_);
+            save_log_file();
+        }
 
         if (current_fd_ >= 0) {
             close(current_fd_);
@@ -271,6 +516,10 @@ private:
             close(status_fd_);
             status_fd_ = -1;
         }
+        if (charge_fd_ >= 0) {
+            close(charge_fd_);
+            charge_fd_ = -1;
+        }
     }
 
     void data_correction(int cycles = 0) {  //数据矫正，为解决不同设备单位问题
@@ -278,14 +527,15 @@ private:
             LOGE("PowerMonitor: We cannot calibrate this data. Manual calibration is required.");
             return;
         }
-        if (app_power_map_.size() <= 1) {  //只有1条时暂时忽略
+        if (app_count() <= 1) {  //只有1条时暂时忽略
             return;
         }
 
         int tooLarge = 0;    //过大的数据量
         int tooSmall = 0;    //过小的数据量
         int normalData = 0;  //正常数据
-        for (const auto& [name, stats] : app_power_map_) {
+        for (size_t id = 0; id < app_names_.size(); ++id) {
+            const AppPower& stats = app_power_[id];
             if (stats.time_sec < 0.01f) {
                 continue;
             }
@@ -303,9 +553,7 @@ private:
             return;
         } else {
             if (tooSmall > tooLarge) {
-                for (auto& [name, stats] : app_power_map_) {  //纠正所有数据
-                    stats.power_joules *= 1000.0;
-                }
+                scale_joules(1000.0f);  //纠正所有数据
                 int untmp = unit_.load(std::memory_order_relaxed);
                 if (untmp - 3 < 0) {
                     return;
@@ -316,9 +564,7 @@ private:
                 data_correction(cycles + 1);  //递归继续检查
 
             } else if (tooSmall < tooLarge) {
-                for (auto& [name, stats] : app_power_map_) {  //纠正所有数据
-                    stats.power_joules /= 1000.0;
-                }
+                scale_joules(0.001f);  //纠正所有数据
                 int untmp = unit_.load(std::memory_order_relaxed);
                 unit_.store(untmp + 3, std::memory_order_relaxed);  //数量级缩小三倍
                 LOGD("PowerMonitor: Data values too large, reducing data.");
@@ -333,56 +579,48 @@ private:
     }
 
     void trim_and_merge_app_power() {  //数据剪裁
-        if (app_power_map_.size() <= 30) {
+        if (app_count() <= 30) {
             return;
         }
 
-        AppPower other_stats{0.0f, 0.0f};
-        std::vector<std::pair<std::string, AppPower>> normal_apps;
-
-        for (const auto& [name, stats] : app_power_map_) {
-            if (name == "_other_") {
-                other_stats.time_sec += stats.time_sec;
-                other_stats.power_joules += stats.power_joules;
-            } else {
-                normal_apps.emplace_back(name, stats);
+        std::vector<int> normal_apps;
+        for (size_t id = OTHER_ID + 1; id < app_names_.size(); ++id) {
+            if (has_data(app_power_[id])) {
+                normal_apps.push_back(static_cast<int>(id));
             }
         }
 
         if (normal_apps.size() <= 20) {
-            app_power_map_["_other_"] = other_stats;
             return;
         }
 
         std::sort(normal_apps.begin(), normal_apps.end(),  //按功耗排序
-                  [](const auto& a, const auto& b) {
-                      return a.second.power_joules > b.second.power_joules;
+                  [this](int a, int b) {
+                      return app_power_[a].power_joules > app_power_[b].power_joules;
                   });
 
-        app_power_map_.clear();
-
-        for (size_t i = 0; i < 20; i++) {  //保留前20
-            app_power_map_[normal_apps[i].first] = normal_apps[i].second;
-        }
-
-        for (size_t i = 20; i < normal_apps.size(); i++) {  //在_other_中存储其余数据
-            other_stats.time_sec += normal_apps[i].second.time_sec;
-            other_stats.power_joules += normal_apps[i].second.power_joules;
+        AppPower& other_stats = app_power_[OTHER_ID];
+        for (size_t i = 20; i < normal_apps.size(); i++) {  //保留前20，在_other_中存储其余数据
+            AppPower& stats = app_power_[normal_apps[i]];
+            other_stats.time_sec += stats.time_sec;
+            other_stats.power_joules += stats.power_joules;
+            stats = AppPower{};
         }
-
-        app_power_map_["_other_"] = other_stats;
     }
 
 public:
-    PowerMonitorTarget(std::string* current_app_ptr, bool* dualBatteryRef)
-        : dualBatteryPtr_(dualBatteryRef), current_app_ptr_(current_app_ptr) {
+    explicit PowerMonitorTarget(bool* dualBatteryRef)
+        : dualBatteryPtr_(dualBatteryRef) {
         load_log_file();
     }
 
     ~PowerMonitorTarget() {
         stop();
         // 析构时保存日志
-        save_log_file();
+        {
+            std::lock_guard<std::mutex> lock(data_mutex_);
+            append_log();
+        }
         if (current_fd_ >= 0) {
             close(current_fd_);
             current_fd_ = -1;
@@ -395,6 +633,10 @@ public:
             close(status_fd_);
             status_fd_ = -1;
         }
+        if (charge_fd_ >= 0) {
+            close(charge_fd_);
+            charge_fd_ = -1;
+        }
     }
 
     std::string getName() const override {
@@ -404,12 +646,17 @@ public:
     nlohmann::json read() override {
         std::lock_guard<std::mutex> lock(data_mutex_);
 
+        size_t apps = app_count();
+        int unit = unit_.load(std::memory_order_relaxed);
         trim_and_merge_app_power();  //发送前修复数据
         data_correction();
+        if (apps != app_count() || unit != unit_.load(std::memory_order_relaxed)) {  //增量无法表达合并与缩放，改写检查点
+            save_log_file();
+        }
 
         nlohmann::json result = nlohmann::json::array();
 
-        for (const auto& [name, stats] : app_power_map_) {
+        for (const auto& [name, stats] : snapshot(app_power_)) {
             nlohmann::json app_data;
             app_data["name"] = name;
             app_data["power_joules"] = stats.power_joules;
@@ -420,8 +667,77 @@ public:
         return result;
     }
 
+    /*按维度查询细分能耗：{"query": {"app": 包名, "mode": 模式, "fps": 刷新率, "state": 状态, "group_by": ["mode", "fps"]}}
+      过滤项均可省略；group_by省略时按全部四个维度列出，为空数组时只给出合计。结果按能耗从高到低排列*/
     nlohmann::json write(const nlohmann::json& data) override {
-        return {{"status", "error"}, {"message", "Power monitor target is read-only"}};
+        if (!data.is_object() || !data.contains("query") || !data["query"].is_object()) {
+            return {{"status", "error"}, {"message", "Power monitor target only accepts queries"}};
+        }
+        const nlohmann::json& query = data["query"];
+
+        static const char* DIMENSIONS[] = {"app", "mode", "fps", "state"};
+        bool group[4] = {true, true, true, true};
+        if (query.contains("group_by")) {
+            if (!query["group_by"].is_array()) {
+                return {{"status", "error"}, {"message", "group_by must be an array"}};
+            }
+            std::fill(std::begin(group), std::end(group), false);
+            for (const auto& item : query["group_by"]) {
+                auto it = std::find_if(std::begin(DIMENSIONS), std::end(DIMENSIONS),
+                                       [&item](const char* name) { return item.is_string() && item.get<std::string>() == name; });
+                if (it == std::end(DIMENSIONS)) {
+                    return {{"status", "error"}, {"message", "Unknown dimension in group_by"}};
+                }
+                group[it - std::begin(DIMENSIONS)] = true;
+            }
+        }
+        if ((query.contains("app") && !query["app"].is_string()) || (query.contains("mode") && !query["mode"].is_string()) ||
+            (query.contains("fps") && !query["fps"].is_number_integer()) || (query.contains("state") && !query["state"].is_string())) {
+            return {{"status", "error"}, {"message", "Invalid filter"}};
+        }
+
+        std::lock_guard<std::mutex> lock(data_mutex_);
+        std::map<std::array<int, 4>, AppPower> groups;  //未分组的维度记为-1
+        buckets_.forEach([&](const EnergyTable::Key& key, EnergyTable::Entry& entry) {
+            if (key.app >= app_names_.size() || key.mode >= mode_names_.size() || key.state > SCREEN_OFF) {
+                return;
+            }
+            if ((query.contains("app") && query["app"].get<std::string>() != app_names_[key.app]) ||
+                (query.contains("mode") && query["mode"].get<std::string>() != mode_names_[key.mode]) ||
+                (query.contains("fps") && query["fps"].get<int>() != key.fps) ||
+                (query.contains("state") && query["state"].get<std::string>() != STATE_NAMES[key.state])) {
+                return;
+            }
+            std::array<int, 4> id = {group[0] ? key.app : -1, group[1] ? key.mode : -1, group[2] ? key.fps : -1, group[3] ? key.state : -1};
+            AppPower& stats = groups[id];
+            stats.time_sec += entry.total.time_sec;
+            stats.power_joules += entry.total.power_joules;
+        });
+
+        std::vector<std::pair<std::array<int, 4>, AppPower>> rows(groups.begin(), groups.end());
+        std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second.power_joules > b.second.power_joules; });
+
+        nlohmann::json result = nlohmann::json::array();
+        for (const auto& [id, stats] : rows) {
+            nlohmann::json row;
+            if (group[0]) {
+                row["app"] = app_names_[id[0]];
+            }
+            if (group[1]) {
+                row["mode"] = mode_names_[id[1]];
+            }
+            if (group[2]) {
+                row["fps"] = id[2];
+            }
+            if (group[3]) {
+                row["state"] = STATE_NAMES[id[3]];
+            }
+            row["time_sec"] = stats.time_sec;
+            row["power_joules"] = stats.power_joules;
+            row["avg_w"] = stats.time_sec > 0.0f ? stats.power_joules / stats.time_sec : 0.0f;
+            result.push_back(std::move(row));
+        }
+        return {{"status", "success"}, {"data", result}};
     }
 
     bool start() {
@@ -454,27 +770,53 @@ public:
         }
     }
 
-    void setScreenStatus(bool sstatus) {                           //传入屏幕状态
-        if (!running_.load(std::memory_order_relaxed) == false) {  //如果没有启用监视
+    void setScreenStatus(bool sstatus) {                //传入屏幕状态
+        if (!running_.load(std::memory_order_relaxed)) {  //如果没有启用监视
             return;
         }
 
         screen_status.store(sstatus, std::memory_order_relaxed);
-        if (stop_.load(std::memory_order_relaxed)) {  //如果监视线程休眠
-            if (sstatus) {                            //如果亮屏
+        if (sstatus) {                                       //如果亮屏
+            std::lock_guard<std::mutex> lock(control_mutex_);  //与工作线程进入休眠互斥，避免错过唤醒
+            if (stop_.load(std::memory_order_relaxed)) {     //如果监视线程休眠
                 stop_.store(false);
                 cv_.notify_all();  //唤醒
             }
         }
     }
 
+    void setMode(const std::string& mode) {  //主循环应用模式后调用
+        int id;
+        {
+            std::lock_guard<std::mutex> lock(data_mutex_);
+            id = intern_mode(mode);
+        }
+        current_mode_.store(id, std::memory_order_relaxed);
+    }
+
+    void setRateSource(const std::atomic<int>* rate) {  //在start之前调用
+        rate_source_ = rate;
+    }
+
+    void setForegroundApp(const std::string& package) {  //主循环中调用，采样线程只读取编号
+        int id = -1;
+        if (!package.empty()) {
+            std::lock_guard<std::mutex> lock(data_mutex_);
+            id = intern(package);
+        }
+        current_app_.store(id, std::memory_order_release);
+    }
+
     bool isRunning() const {
         return running_.load(std::memory_order_relaxed);
     }
 
     void clearStats() {
         std::lock_guard<std::mutex> lock(data_mutex_);
-        app_power_map_.clear();
+        std::fill(app_power_.begin(), app_power_.end(), AppPower{});
+        std::fill(pending_.begin(), pending_.end(), AppPower{});
+        buckets_.clear();
+        save_log_file();
         LOGI("Power consumption records cleaned up");
     }
 };
@@ -0,0 +1,48 @@
+/*查看各个inotify监听器的事件统计*/
+#ifndef WATCHER_MODULE_HPP
+#define WATCHER_MODULE_HPP
+
+#include "JSONSocket/JSONSocket.hpp"
+#include "inotifywatcher.hpp"
+
+class WatcherStatsTarget : public ConfigTarget {
+public:
+    std::string getName() const override {
+        return "inotifyStats";
+    }
+
+    nlohmann::json read() override {
+        nlohmann::json result = nlohmann::json::array();
+        for (const auto& stats : FileWatcher::getAllStats()) {
+            nlohmann::json item;
+            item["name"] = stats.name;
+            item["window_ms"] = stats.window_ms;
+            item["effective_ms"] = stats.effective_ms;
+            item["storm"] = stats.storm;
+            item["storms"] = stats.storms;
+            item["events"] = stats.events;
+            item["notifications"] = stats.notifications;
+            item["rate"] = stats.rate;
+            item["lost"] = stats.lost;
+            item["invalidations"] = stats.invalidations;
+            item["recoveries"] = stats.recoveries;
+
+            nlohmann::json paths = nlohmann::json::array();
+            for (const auto& path : stats.paths) {
+                paths.push_back({{"path", path.path},
+                                 {"watching", path.watching},
+                                 {"events", path.events},
+                                 {"rate", path.rate}});
+            }
+            item["paths"] = paths;
+            result.push_back(std::move(item));
+        }
+        return result;
+    }
+
+    nlohmann::json write(const nlohmann::json& data) override {
+        return {{"status", "error"}, {"message", "inotifyStats target is read-only"}};
+    }
+};
+
+#endif
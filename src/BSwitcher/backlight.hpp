@@ -0,0 +1,154 @@
+/* 背光亮度监听 */
+/* 背光驱动在亮度变化时对actual_brightness做sysfs_notify，以EPOLLPRI挂在Reactor上即可立即得知 */
+/* 数值从brightness读取，与lowbri_for_fps的单位一致；不支持通知的驱动由定时器轮询 */
+#ifndef BACKLIGHT_HPP
+#define BACKLIGHT_HPP
+
+#include "Alog.hpp"
+#include "reactor.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+class BacklightWatcher {
+public:
+    using Callback = std::function<void(int)>;  //亮度变化时在Reactor线程中调用
+
+    BacklightWatcher() = default;
+
+    ~BacklightWatcher() {
+        stop();
+    }
+
+    bool start(const std::string& dir, Callback callback) {  //dir如/sys/class/backlight/panel0-backlight
+        stop();
+        std::lock_guard<std::mutex> lock(mutex_);
+        callback_ = std::move(callback);
+
+        value_fd_ = open((dir + "/brightness").c_str(), O_RDONLY | O_CLOEXEC);
+        if (value_fd_ < 0) {
+            LOGW("BacklightWatcher: failed to open %s/brightness: %s", dir.c_str(), strerror(errno));
+            return false;
+        }
+        last_ = read_value(value_fd_);
+
+        notify_fd_ = open((dir + "/actual_brightness").c_str(), O_RDONLY | O_CLOEXEC);
+        if (notify_fd_ >= 0) {
+            read_value(notify_fd_);  //sysfs需要先读一次才会在下次变化时通知
+            if (!Reactor::instance().add(notify_fd_, EPOLLPRI | EPOLLERR, [this](uint32_t) { on_change(true); })) {
+                close(notify_fd_);
+                notify_fd_ = -1;
+            }
+        }
+
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd_ >= 0 && !Reactor::instance().add(timer_fd_, EPOLLIN, [this](uint32_t) { on_timer(); })) {
+            close(timer_fd_);
+            timer_fd_ = -1;
+        }
+        notified_ = notify_fd_ >= 0;
+        arm_timer();
+
+        LOGI("BacklightWatcher: %s, brightness %d", notified_ ? "event driven" : "polling", last_.load());
+        return notify_fd_ >= 0 || timer_fd_ >= 0;
+    }
+
+    void stop() {
+        for (int* fd : {&notify_fd_, &timer_fd_}) {
+            if (*fd >= 0) {
+                Reactor::instance().remove(*fd);  //返回后不会再有回调
+                close(*fd);
+                *fd = -1;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (value_fd_ >= 0) {
+            close(value_fd_);
+            value_fd_ = -1;
+        }
+        callback_ = nullptr;
+    }
+
+    int brightness() const {
+        return last_.load(std::memory_order_relaxed);
+    }
+
+    bool eventDriven() const {
+        return notified_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int POLL_MS = 1000;    //不支持通知时的轮询间隔
+    static const int VERIFY_MS = 30000;  //支持通知时仍低频核对，发现漏报则退回轮询
+
+    int value_fd_{-1};
+    int notify_fd_{-1};
+    int timer_fd_{-1};
+    std::atomic<int> last_{-1};
+    std::atomic<bool> notified_{false};
+    Callback callback_;
+    std::mutex mutex_;
+
+    static int read_value(int fd) {
+        char buf[16];
+        ssize_t length = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (length <= 0) {
+            return -1;
+        }
+        buf[length] = '\0';
+        char* end;
+        long value = strtol(buf, &end, 10);
+        return end != buf ? static_cast<int>(value) : -1;
+    }
+
+    void arm_timer() {
+        if (timer_fd_ < 0) {
+            return;
+        }
+        int ms = notified_.load(std::memory_order_relaxed) ? VERIFY_MS : POLL_MS;
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+        spec.it_interval = spec.it_value;
+        timerfd_settime(timer_fd_, 0, &spec, nullptr);
+    }
+
+    void on_timer() {
+        uint64_t expirations;
+        ssize_t result = read(timer_fd_, &expirations, sizeof(expirations));
+        (void)result;
+        if (!on_change(false) || !notified_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        LOGW("BacklightWatcher: change missed by notification, polling instead");  //驱动未调用sysfs_notify
+        notified_.store(false, std::memory_order_relaxed);
+        arm_timer();
+    }
+
+    bool on_change(bool from_notify) {  //返回亮度是否变化
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (from_notify && notify_fd_ >= 0) {
+            read_value(notify_fd_);  //重新布防
+        }
+        if (value_fd_ < 0) {
+            return false;
+        }
+        int value = read_value(value_fd_);
+        if (value < 0 || value == last_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        last_.store(value, std::memory_order_relaxed);
+        if (callback_) {
+            callback_(value);
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,239 @@
+/* 子进程监督 */
+/* 由此fork的子进程都会被回收：优先用pidfd挂在Reactor上，内核不支持时由定时器轮询 */
+/* 只回收自己登记的pid，不使用waitpid(-1)，以免抢走popen/system的子进程 */
+#ifndef CHILD_SUPERVISOR_HPP
+#define CHILD_SUPERVISOR_HPP
+
+#include "Alog.hpp"
+#include "reactor.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434  //各架构统一的调用号，旧NDK头文件中没有
+#endif
+
+class ChildSupervisor {
+public:
+    struct TagStats {  //同一命令的统计
+        uint64_t spawns = 0;
+        uint64_t exits = 0;
+        uint64_t failures = 0;  //非0退出或被信号终止
+        uint64_t spawn_errors = 0;
+        double total_ms = 0.0;
+        double max_ms = 0.0;
+        int last_exit = 0;
+    };
+
+    struct Stats {
+        uint64_t spawned = 0;
+        uint64_t reaped = 0;
+        size_t running = 0;
+        bool pidfd = false;  //是否在使用pidfd
+        std::map<std::string, TagStats> tags;
+    };
+
+    static ChildSupervisor& instance() {  //与Reactor一样随进程存在
+        static ChildSupervisor* supervisor = new ChildSupervisor();
+        return *supervisor;
+    }
+
+    pid_t spawn(const std::vector<std::string>& args) {  //fork并exec，不等待
+        if (args.empty()) {
+            return -1;
+        }
+
+        std::vector<char*> argv;
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        std::lock_guard<std::mutex> lock(mutex_);  //在锁内fork，保证回收前已登记
+        pid_t pid = fork();
+        if (pid == 0) {
+            sigset_t empty;
+            sigemptyset(&empty);
+            sigprocmask(SIG_SETMASK, &empty, nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+
+        TagStats& tag = stats_.tags[args[0]];
+        if (pid < 0) {
+            LOGW("ChildSupervisor: fork failed: %s", strerror(errno));
+            tag.spawn_errors++;
+            return -1;
+        }
+        track_locked(pid, args[0]);
+        return pid;
+    }
+
+    void adopt(pid_t pid, const std::string& tag) {  //接管别处fork、尚未回收的子进程，不等待
+        if (pid <= 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        track_locked(pid, tag);
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.running = children_.size();
+        stats.pidfd = pidfd_supported_;
+        return stats;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const int SWEEP_MS = 1000;
+
+    struct Child {
+        std::string tag;
+        clock::time_point start;
+        int pidfd = -1;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<pid_t, Child> children_;
+    Stats stats_;
+    bool pidfd_supported_{true};
+    int sweep_fd_{-1};
+    bool sweep_armed_{false};
+
+    ChildSupervisor() {
+        sweep_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (sweep_fd_ < 0 || !Reactor::instance().add(sweep_fd_, EPOLLIN, [this](uint32_t) { on_sweep(); })) {
+            LOGW("ChildSupervisor: sweep timer unavailable");
+        }
+    }
+
+    ChildSupervisor(const ChildSupervisor&) = delete;
+    ChildSupervisor& operator=(const ChildSupervisor&) = delete;
+
+    void track_locked(pid_t pid, const std::string& tag) {
+        stats_.tags[tag].spawns++;
+        stats_.spawned++;
+
+        Child child;
+        child.tag = tag;
+        child.start = clock::now();
+        child.pidfd = pidfd_supported_ ? static_cast<int>(syscall(SYS_pidfd_open, pid, 0)) : -1;
+        if (child.pidfd < 0 && pidfd_supported_) {
+            if (errno == ENOSYS) {
+                LOGI("ChildSupervisor: pidfd_open unsupported, polling children");
+                pidfd_supported_ = false;
+            }
+        }
+        children_[pid] = child;
+
+        if (child.pidfd >= 0) {
+            Reactor::instance().add(child.pidfd, EPOLLIN, [this, pid](uint32_t) { on_pidfd(pid); });
+        } else {
+            arm_sweep_locked();
+        }
+    }
+
+    void arm_sweep_locked() {
+        if (sweep_fd_ < 0 || sweep_armed_) {
+            return;
+        }
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = SWEEP_MS / 1000;
+        spec.it_value.tv_nsec = static_cast<long>(SWEEP_MS % 1000) * 1000000L;
+        spec.it_interval = spec.it_value;
+        sweep_armed_ = timerfd_settime(sweep_fd_, 0, &spec, nullptr) == 0;
+    }
+
+    void disarm_sweep_locked() {
+        if (!sweep_armed_) {
+            return;
+        }
+        struct itimerspec spec = {};
+        timerfd_settime(sweep_fd_, 0, &spec, nullptr);
+        sweep_armed_ = false;
+    }
+
+    bool reap_locked(pid_t pid) {  //已退出则记录并移除
+        int status = 0;
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if (result == 0) {
+            return false;
+        }
+
+        auto it = children_.find(pid);
+        if (it == children_.end()) {
+            return true;
+        }
+
+        TagStats& tag = stats_.tags[it->second.tag];
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - it->second.start).count();
+        int code = -1;
+        if (result > 0) {
+            if (WIFEXITED(status)) {
+                code = WEXITSTATUS(status);
+            } else if (WIFSIGNALED(status)) {
+                code = 128 + WTERMSIG(status);
+            }
+        }  //ECHILD：已被别处回收，按失败记录
+        tag.exits++;
+        tag.last_exit = code;
+        tag.total_ms += ms;
+        if (ms > tag.max_ms) {
+            tag.max_ms = ms;
+        }
+        if (code != 0) {
+            tag.failures++;
+        }
+        stats_.reaped++;
+
+        if (it->second.pidfd >= 0) {
+            Reactor::instance().remove(it->second.pidfd);  //在Reactor线程中调用，不会等待自己
+            close(it->second.pidfd);
+        }
+        children_.erase(it);
+        return true;
+    }
+
+    void on_pidfd(pid_t pid) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reap_locked(pid);
+    }
+
+    void on_sweep() {
+        uint64_t expirations;
+        ssize_t result = read(sweep_fd_, &expirations, sizeof(expirations));
+        (void)result;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<pid_t> polled;
+        for (const auto& [pid, child] : children_) {
+            if (child.pidfd < 0) {
+                polled.push_back(pid);
+            }
+        }
+        size_t remaining = 0;
+        for (pid_t pid : polled) {
+            if (!reap_locked(pid)) {
+                remaining++;
+            }
+        }
+        if (remaining == 0) {
+            disarm_sweep_locked();
+        }
+    }
+};
+
+#endif
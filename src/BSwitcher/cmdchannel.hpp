@@ -0,0 +1,314 @@
+/* 常驻的命令通道 */
+/* 保持一个sh进程，通过管道发送命令，每条命令后回显带序号的完成标记 */
+/* 省去每次从本进程fork/exec的开销；完成标记由调用者的epoll读取，用于统计延迟与CPU耗时 */
+/* 写入端非阻塞，sh卡住时不会拖住调用者，由调用者改用单独的进程执行 */
+#ifndef CMD_CHANNEL_HPP
+#define CMD_CHANNEL_HPP
+
+#include "Alog.hpp"
+#include "childsupervisor.hpp"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+class CommandChannel {
+public:
+    struct Stats {
+        bool alive = false;
+        unsigned int restarts = 0;
+        uint64_t commands = 0;
+        uint64_t failures = 0;  //返回值非0或进程退出
+        double last_ms = 0.0;
+        double max_ms = 0.0;
+        double total_ms = 0.0;
+        double cpu_ms = 0.0;  //子进程累计CPU时间，含其等待过的命令
+        double last_cpu_ms = 0.0;
+    };
+
+    using CompletionHook = std::function<void(uint64_t seq, double ms, int rc)>;  //在调用handle的线程中执行
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr const char* MARKER = "@bsw ";
+    static const size_t MAX_PENDING = 16;  //积压过多时说明sh卡住，重启
+
+    struct Pending {
+        uint64_t seq;
+        clock::time_point start;
+    };
+
+    std::string shell_{"/system/bin/sh"};
+    pid_t pid_{-1};
+    int in_fd_{-1};   //写入命令，非阻塞
+    int out_fd_{-1};  //读取完成标记
+    int epoll_fd_{-1};
+    uint64_t seq_{0};
+    std::deque<Pending> pending_;
+    std::string line_;
+    unsigned long long last_cpu_ticks_{0};
+    CompletionHook hook_;
+
+    mutable std::mutex stats_mutex_;
+    Stats stats_;
+
+    unsigned long long cpu_ticks() const {  //sh自身与已回收子进程的utime+stime+cutime+cstime
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", pid_);
+        FILE* fp = fopen(path, "r");
+        if (!fp) {
+            return 0;
+        }
+        char buf[512];
+        size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+        fclose(fp);
+        buf[n] = '\0';
+
+        const char* p = strrchr(buf, ')');  //comm可能含空格
+        if (!p) {
+            return 0;
+        }
+        unsigned long long utime = 0, stime = 0;
+        long long cutime = 0, cstime = 0;
+        if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld %lld",
+                   &utime, &stime, &cutime, &cstime) != 4) {
+            return 0;
+        }
+        return utime + stime + static_cast<unsigned long long>(cutime + cstime);
+    }
+
+    static void clear_sigpipe() {  //写已关闭的管道后，取走挂起的SIGPIPE
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        struct timespec zero = {0, 0};
+        while (sigtimedwait(&set, nullptr, &zero) > 0) {
+        }
+    }
+
+    void complete(uint64_t seq, int rc) {
+        auto now = clock::now();
+        while (!pending_.empty() && pending_.front().seq <= seq) {
+            Pending p = pending_.front();
+            pending_.pop_front();
+            if (p.seq != seq) {  //理论上不会跳号
+                continue;
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(now - p.start).count();
+            unsigned long long ticks = cpu_ticks();
+            double cpu_ms = ticks >= last_cpu_ticks_ ? (ticks - last_cpu_ticks_) * 1000.0 / sysconf(_SC_CLK_TCK) : 0.0;
+            last_cpu_ticks_ = ticks;
+
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.commands++;
+                if (rc != 0) {
+                    stats_.failures++;
+                }
+                stats_.last_ms = ms;
+                stats_.total_ms += ms;
+                if (ms > stats_.max_ms) {
+                    stats_.max_ms = ms;
+                }
+                stats_.last_cpu_ms = cpu_ms;
+                stats_.cpu_ms += cpu_ms;
+            }
+            if (hook_) {
+                hook_(seq, ms, rc);
+            }
+        }
+    }
+
+public:
+    CommandChannel() = default;
+
+    ~CommandChannel() {
+        stop();
+    }
+
+    bool start(int epoll_fd, const std::string& shell = "/system/bin/sh") {  //启动sh并把输出注册到epoll
+        close_helper();
+        shell_ = shell;
+
+        int in_pipe[2], out_pipe[2];
+        if (pipe2(in_pipe, O_CLOEXEC) < 0) {
+            LOGW("CommandChannel: pipe failed: %s", strerror(errno));
+            return false;
+        }
+        if (pipe2(out_pipe, O_CLOEXEC) < 0) {
+            LOGW("CommandChannel: pipe failed: %s", strerror(errno));
+            close(in_pipe[0]);
+            close(in_pipe[1]);
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            sigset_t empty;
+            sigemptyset(&empty);
+            sigprocmask(SIG_SETMASK, &empty, nullptr);
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(in_pipe[0], STDIN_FILENO);
+            dup2(out_pipe[1], STDOUT_FILENO);
+            if (null_fd >= 0) {
+                dup2(null_fd, STDERR_FILENO);
+            }
+            execl(shell_.c_str(), "sh", nullptr);
+            _exit(127);
+        }
+        close(in_pipe[0]);
+        close(out_pipe[1]);
+        if (pid < 0) {
+            LOGW("CommandChannel: fork failed: %s", strerror(errno));
+            close(in_pipe[1]);
+            close(out_pipe[0]);
+            return false;
+        }
+
+        pid_ = pid;
+        in_fd_ = in_pipe[1];
+        out_fd_ = out_pipe[0];
+        fcntl(in_fd_, F_SETFL, fcntl(in_fd_, F_GETFL) | O_NONBLOCK);
+        fcntl(out_fd_, F_SETFL, fcntl(out_fd_, F_GETFL) | O_NONBLOCK);
+
+        epoll_fd_ = epoll_fd;
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = out_fd_;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, out_fd_, &event) < 0) {
+            LOGW("CommandChannel: failed to add to epoll: %s", strerror(errno));
+            close_helper();
+            return false;
+        }
+
+        last_cpu_ticks_ = cpu_ticks();
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.alive = true;
+        LOGD("CommandChannel started, pid %d", pid_);
+        return true;
+    }
+
+    void stop() {  //结束sh，之后不再自动重启
+        close_helper();
+        epoll_fd_ = -1;
+    }
+
+    void setHook(CompletionHook hook) {
+        hook_ = std::move(hook);
+    }
+
+    uint64_t lastSeq() const {  //最近一次submit的序号
+        return seq_;
+    }
+
+    bool alive() const {
+        return pid_ > 0;
+    }
+
+    bool owns(int fd) const {
+        return fd >= 0 && fd == out_fd_;
+    }
+
+    bool submit(const std::string& command) {  //发送一条命令，不等待完成；返回false时由调用者自行执行
+        if (pid_ <= 0 || pending_.size() >= MAX_PENDING) {
+            if (!restart()) {
+                return false;
+            }
+        }
+
+        uint64_t seq = ++seq_;
+        std::string line = "{ " + command + "; } >/dev/null 2>&1; echo \"" + MARKER + std::to_string(seq) + " $?\"\n";
+        ssize_t written = write(in_fd_, line.data(), line.size());
+        if (written != static_cast<ssize_t>(line.size())) {  //sh已退出，或管道已满(EAGAIN)/只写入一部分，命令不完整
+            clear_sigpipe();
+            restart();  //本条交给调用者，下一条使用新的sh
+            return false;
+        }
+        pending_.push_back({seq, clock::now()});
+        return true;
+    }
+
+    void handle() {  //读取完成标记
+        char buf[256];
+        ssize_t length;
+        while ((length = read(out_fd_, buf, sizeof(buf))) > 0) {
+            line_.append(buf, static_cast<size_t>(length));
+            size_t pos;
+            while ((pos = line_.find('\n')) != std::string::npos) {
+                std::string line = line_.substr(0, pos);
+                line_.erase(0, pos + 1);
+
+                unsigned long long seq = 0;
+                int rc = 0;
+                if (line.compare(0, strlen(MARKER), MARKER) == 0 &&
+                    sscanf(line.c_str() + strlen(MARKER), "%llu %d", &seq, &rc) == 2) {
+                    complete(seq, rc);
+                }
+            }
+        }
+
+        if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {  //sh退出，下次提交时重启
+            LOGW("CommandChannel: helper exited");
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.failures += pending_.size();
+            }
+            pending_.clear();
+            close_helper();
+        }
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        return stats_;
+    }
+
+private:
+    bool restart() {
+        if (epoll_fd_ < 0) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.failures += pending_.size();
+            stats_.restarts++;
+        }
+        LOGW("CommandChannel: restarting helper");
+        return start(epoll_fd_, shell_);
+    }
+
+    void close_helper() {
+        if (out_fd_ >= 0) {
+            if (epoll_fd_ >= 0) {
+                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, out_fd_, nullptr);
+            }
+            close(out_fd_);
+            out_fd_ = -1;
+        }
+        if (in_fd_ >= 0) {
+            close(in_fd_);
+            in_fd_ = -1;
+        }
+        if (pid_ > 0) {
+            kill(pid_, SIGKILL);
+            ChildSupervisor::instance().adopt(pid_, shell_);  //由ChildSupervisor回收，不在此等待
+            pid_ = -1;
+        }
+        pending_.clear();
+        line_.clear();
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.alive = false;
+    }
+};
+
+#endif
@@ -60,6 +60,22 @@ const nlohmann::json CONFIG_SCHEMA = {                             //定义前
      {"options", "availableModes"},
      {"dependsOn", {{"field", "scene_strict"}, {"condition", false}}}},
     
+    {{"key", "switch_burst"},
+     {"type", "number"},
+     {"label", "切换突发上限"},
+     {"description", "短时间内允许连续切换模式的次数，超出后延迟切换。0为不限制"},
+     {"min", 0},
+     {"max", 60},
+     {"category", "模式设置"}},
+
+    {{"key", "switch_refill_time"},
+     {"type", "number"},
+     {"label", "切换恢复间隔"},
+     {"description", "每隔多少秒恢复一次切换机会（秒）"},
+     {"min", 0},
+     {"max", 600},
+     {"category", "模式设置"}},
+
     {{"key", "custom_mode"},
      {"type", "text"},
      {"label", "自定义模式"},
@@ -71,7 +87,7 @@ const nlohmann::json CONFIG_SCHEMA = {                             //定义前
      {"label", "动态刷新率"},
      {"description", "启用动态刷新率"},
      {"category", "动态刷新率"},
-     {"affects", {"up_fps","down_fps","fps_idle_time","screen_resolution"}}},
+     {"affects", {"up_fps","down_fps","fps_idle_time","fps_tap_idle_time","fps_decay","fps_stylus","fps_keyboard","fps_content_aware","screen_resolution"}}},
 
     {{"key", "up_fps"},
      {"type", "select"},
@@ -96,6 +112,41 @@ const nlohmann::json CONFIG_SCHEMA = {                             //定义前
      {"category", "动态刷新率"},
     {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
 
+    {{"key", "fps_tap_idle_time"},
+     {"type", "number"},
+     {"label", "点击空闲时间"},
+     {"description", "点击或停住后抬起时使用的空闲时间(毫秒)，0为与空闲等待时间相同。快速滑动抬起时会自动延长到惯性滚动结束"},
+     {"category", "动态刷新率"},
+     {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
+
+    {{"key", "fps_decay"},
+     {"type", "text"},
+     {"label", "逐级降频"},
+     {"description", "抬起后逐级降低，格式为刷新率:毫秒，如90:1000,60:3000,30:10000。留空则只切换到空闲刷新率"},
+     {"category", "动态刷新率"},
+     {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
+
+    {{"key", "fps_stylus"},
+     {"type", "checkbox"},
+     {"label", "手写笔触发"},
+     {"description", "手写笔接触屏幕时也切换到触摸刷新率"},
+     {"category", "动态刷新率"},
+    {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
+
+    {{"key", "fps_keyboard"},
+     {"type", "checkbox"},
+     {"label", "键盘触发"},
+     {"description", "外接键盘按键时也切换到触摸刷新率"},
+     {"category", "动态刷新率"},
+    {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
+
+    {{"key", "fps_content_aware"},
+     {"type", "checkbox"},
+     {"label", "跟随内容帧率"},
+     {"description", "视频或游戏以固定帧率渲染时，空闲刷新率不低于其最低整数倍，避免抖动"},
+     {"category", "动态刷新率"},
+     {"dependsOn", {{"field", "dynamic_fps"}, {"condition", true}}}},
+
     {{"key", "lowbri_for_fps"},
      {"type", "number"},
      {"label", "低亮度阈值"},
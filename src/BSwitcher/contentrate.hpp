@@ -0,0 +1,283 @@
+/* 内容帧率采样 */
+/* 视频与不少游戏以固定的30/60/90帧渲染，面板刷新率取其最低的整数倍可避免抖动与多余的刷新 */
+/* 采样来源可替换：默认读取dumpsys SurfaceFlinger --latency，测试时可换成固定值 */
+#ifndef CONTENT_RATE_HPP
+#define CONTENT_RATE_HPP
+
+#include "Alog.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ContentRateSource {  //返回前台应用当前的内容帧率，未知或画面静止时返回0
+public:
+    virtual ~ContentRateSource() = default;
+    virtual int sample(const std::string& package) = 0;
+};
+
+class SurfaceFlingerLatencySource : public ContentRateSource {
+private:
+    std::string package_;
+    std::string layer_;  //缓存的图层名，应用变化或图层消失时重新查找
+
+    static std::string run(const std::string& cmd) {
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
+        if (!pipe) {
+            return "";
+        }
+        std::string output;
+        char buffer[256];
+        while (fgets(buffer, sizeof(buffer), pipe.get())) {
+            output += buffer;
+        }
+        return output;
+    }
+
+    static std::string quote(const std::string& str) {  //图层名含空格与括号
+        std::string quoted = "'";
+        for (char c : str) {
+            quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+        }
+        return quoted + "'";
+    }
+
+    static std::string find_layer(const std::string& list, const std::string& package) {  //优先SurfaceView，视频与游戏在其上渲染
+        std::istringstream iss(list);
+        std::string line, fallback;
+        while (std::getline(iss, line)) {
+            if (line.find(package) == std::string::npos) {
+                continue;
+            }
+            if (line.compare(0, 11, "SurfaceView") == 0 && line.find("Background") == std::string::npos) {
+                return line;
+            }
+            if (fallback.empty() && line.find('#') != std::string::npos) {
+                fallback = line;
+            }
+        }
+        return fallback;
+    }
+
+public:
+    /*--latency输出：第一行为刷新周期(ns)，之后每行为 期望显示 实际显示 完成渲染 三个时间戳
+      用最近1秒内实际显示的帧数估计帧率；最新一帧超过1秒前时视为画面静止*/
+    static int estimate(const std::string& output, int64_t now_ns) {
+        std::istringstream iss(output);
+        std::string line;
+        std::vector<int64_t> presents;
+        std::getline(iss, line);  //刷新周期
+        while (std::getline(iss, line)) {
+            long long desired = 0, actual = 0, ready = 0;
+            if (sscanf(line.c_str(), "%lld %lld %lld", &desired, &actual, &ready) == 3 &&
+                actual > 0 && actual != INT64_MAX) {
+                presents.push_back(actual);
+            }
+        }
+        if (presents.size() < 10) {
+            return 0;
+        }
+        std::sort(presents.begin(), presents.end());
+
+        const int64_t SECOND = 1000000000LL;
+        int64_t newest = presents.back();
+        if (now_ns > 0 && now_ns - newest > SECOND) {
+            return 0;
+        }
+        auto first = std::lower_bound(presents.begin(), presents.end(), newest - SECOND);
+        size_t frames = static_cast<size_t>(presents.end() - first);
+        if (frames < 10) {
+            return 0;
+        }
+        double fps = (frames - 1) * 1e9 / static_cast<double>(newest - *first);
+        return snap(fps);
+    }
+
+    static int snap(double fps) {  //对齐到常见的内容帧率，差距较大时视为不固定
+        static const int RATES[] = {24, 25, 30, 48, 50, 60, 72, 90, 120, 144, 165};
+        for (int rate : RATES) {
+            if (std::abs(fps - rate) <= rate * 0.08) {
+                return rate;
+            }
+        }
+        return 0;
+    }
+
+    int sample(const std::string& package) override {
+        if (package.empty()) {
+            return 0;
+        }
+        if (package != package_ || layer_.empty()) {
+            package_ = package;
+            layer_ = find_layer(run("dumpsys SurfaceFlinger --list"), package);
+            if (layer_.empty()) {
+                return 0;
+            }
+        }
+
+        std::string output = run("dumpsys SurfaceFlinger --latency " + quote(layer_));
+        if (output.find('\n') == std::string::npos || output.find('\n') + 1 >= output.size()) {  //只有刷新周期，图层可能已不存在
+            layer_.clear();
+            return 0;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return estimate(output, static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec);
+    }
+};
+
+class ContentRateSampler {  //在独立线程中定期采样，结果稳定后回调；结果不变时逐级延长间隔
+public:
+    using Callback = std::function<void(int)>;
+
+    ~ContentRateSampler() {
+        stop();
+    }
+
+    void setSource(std::unique_ptr<ContentRateSource> source) {  //在start之前调用
+        std::lock_guard<std::mutex> lock(mutex_);
+        source_ = std::move(source);
+    }
+
+    void start(Callback callback) {
+        if (running_.exchange(true)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callback_ = std::move(callback);
+            if (!source_) {
+                source_ = std::make_unique<SurfaceFlingerLatencySource>();
+            }
+            stop_ = false;
+        }
+        worker_thread_ = std::thread(&ContentRateSampler::work, this);
+    }
+
+    void stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (worker_thread_.joinable()) {
+            worker_thread_.join();
+        }
+    }
+
+    void setPackage(const std::string& package) {  //前台应用，空表示不采样(如熄屏)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (package == package_) {
+                return;
+            }
+            package_ = package;
+        }
+        cv_.notify_all();
+    }
+
+    void setActive(bool active) {  //触摸期间暂停采样，此时使用up_fps，内容帧率用不上
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (active == active_) {
+                return;
+            }
+            active_ = active;
+        }
+        cv_.notify_all();
+    }
+
+    int current() const {
+        return reported_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr std::chrono::seconds INTERVALS[] = {std::chrono::seconds(2), std::chrono::seconds(10), std::chrono::seconds(30)};
+    static constexpr size_t LEVELS = sizeof(INTERVALS) / sizeof(INTERVALS[0]);
+
+    std::unique_ptr<ContentRateSource> source_;
+    Callback callback_;
+    std::string package_;
+    std::atomic<bool> running_{false};
+    bool stop_ = false;
+    bool active_ = true;
+    std::atomic<int> reported_{0};
+    std::thread worker_thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void wait_next(std::unique_lock<std::mutex>& lock, const std::string& package, size_t& level) {  //等到下次采样，暂停期间不计时
+        auto changed = [this, &package]() { return stop_ || package_ != package; };
+        while (true) {
+            if (!cv_.wait_for(lock, INTERVALS[level], [this, &changed]() { return changed() || !active_; })) {
+                return;
+            }
+            if (changed()) {
+                return;
+            }
+            cv_.wait(lock, [this, &package]() { return stop_ || active_ || (package_ != package && package_.empty()); });  //熄屏时仍需撤销
+            if (changed()) {
+                return;
+            }
+            level = 0;  //恢复后画面可能已变化，按最短间隔重新开始
+        }
+    }
+
+    void work() {
+        int last = -1;     //连续两次相同才上报，避免偶发的卡顿改变刷新率
+        size_t level = 0;  //INTERVALS的下标
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            std::string package = package_;
+            lock.unlock();
+            int rate = package.empty() ? 0 : source_->sample(package);
+            lock.lock();
+            if (stop_) {
+                break;
+            }
+
+            if (package != package_) {  //采样期间前台变化，结果作废
+                last = -1;
+                level = 0;
+                continue;
+            }
+            if (package.empty()) {  //不采样时立即撤销
+                last = 0;
+            }
+            if (rate == last && rate != reported_.load(std::memory_order_relaxed)) {
+                reported_.store(rate, std::memory_order_relaxed);
+                LOGD("Content rate of %s: %d", package.c_str(), rate);
+                lock.unlock();
+                callback_(rate);
+                lock.lock();
+                level = 0;
+            } else if (rate == last) {  //与已上报的一致
+                level = std::min(level + 1, LEVELS - 1);
+            } else {
+                level = 0;
+            }
+            last = rate;
+
+            if (package.empty()) {  //熄屏时不计时，等前台变化
+                cv_.wait(lock, [this, &package]() { return stop_ || package_ != package; });
+                continue;
+            }
+            wait_next(lock, package, level);
+        }
+    }
+};
+
+#endif
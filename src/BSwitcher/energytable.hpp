@@ -0,0 +1,98 @@
+/* 分维度的能耗表 */
+/* 键为打包成64位的(应用, 模式, 刷新率, 状态)，定长开放寻址，构造后不再分配，采样时只做整数运算 */
+/* 非线程安全，由调用者加锁 */
+#ifndef ENERGY_TABLE_HPP
+#define ENERGY_TABLE_HPP
+
+#include "powerlog.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class EnergyTable {
+public:
+    struct Key {
+        uint16_t app = 0;
+        uint8_t mode = 0;
+        uint16_t fps = 0;
+        uint8_t state = 0;
+
+        uint64_t pack() const {  //最高位置1，0保留为空槽
+            return (1ULL << 63) | (static_cast<uint64_t>(app) << 32) | (static_cast<uint64_t>(mode) << 24) |
+                   (static_cast<uint64_t>(fps) << 8) | state;
+        }
+
+        static Key unpack(uint64_t packed) {
+            Key key;
+            key.app = static_cast<uint16_t>(packed >> 32);
+            key.mode = static_cast<uint8_t>(packed >> 24);
+            key.fps = static_cast<uint16_t>(packed >> 8);
+            key.state = static_cast<uint8_t>(packed);
+            return key;
+        }
+    };
+
+    struct Entry {
+        uint64_t key = 0;
+        AppPower total;    //累计值
+        AppPower pending;  //尚未写入记录的增量
+    };
+
+    static constexpr size_t CAPACITY = 4096;            //2的幂
+    static constexpr size_t SOFT_LIMIT = CAPACITY / 2;  //超过后新键由调用者合并，余下的槽留给合并后的键
+
+    EnergyTable()
+        : slots_(CAPACITY) {}
+
+    /*查找或插入，表中已有limit个键时不再插入新键，返回nullptr*/
+    Entry* find(const Key& key, size_t limit = CAPACITY - 1) {
+        uint64_t packed = key.pack();
+        for (size_t i = hash(packed) & (CAPACITY - 1);; i = (i + 1) & (CAPACITY - 1)) {
+            Entry& slot = slots_[i];
+            if (slot.key == packed) {
+                return &slot;
+            }
+            if (slot.key == 0) {  //线性探测遇到空槽即不存在
+                if (used_ >= limit) {
+                    return nullptr;
+                }
+                slot.key = packed;
+                ++used_;
+                return &slot;
+            }
+        }
+    }
+
+    size_t size() const {
+        return used_;
+    }
+
+    void clear() {
+        std::fill(slots_.begin(), slots_.end(), Entry{});
+        used_ = 0;
+    }
+
+    template <typename Func>
+    void forEach(Func&& func) {  //func(Key, Entry&)
+        for (auto& slot : slots_) {
+            if (slot.key != 0) {
+                func(Key::unpack(slot.key), slot);
+            }
+        }
+    }
+
+private:
+    std::vector<Entry> slots_;
+    size_t used_ = 0;
+
+    static size_t hash(uint64_t key) {  //murmur3的64位收尾混合
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return static_cast<size_t>(key);
+    }
+};
+
+#endif
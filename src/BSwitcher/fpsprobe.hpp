@@ -0,0 +1,207 @@
+/* 刷新率控制项探测 */
+/* 不同系统只认部分settings项。逐项写入后读取dumpsys display中的当前模式，找出真正生效的项 */
+/* 结果按ro.build.fingerprint缓存，系统更新后重新探测；无法判断时缓存空表，表示写入全部项 */
+#ifndef FPS_PROBE_HPP
+#define FPS_PROBE_HPP
+
+#include <Alog.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+class RefreshRateProbe {
+public:
+    struct Key {
+        std::string ns;  //system或secure
+        std::string name;
+
+        bool operator==(const Key& other) const {
+            return ns == other.ns && name == other.name;
+        }
+    };
+
+    static const std::vector<Key>& candidates() {  //原先每次都写入的全部项
+        static const std::vector<Key> keys = {{"system", "peak_refresh_rate"},
+                                              {"system", "min_refresh_rate"},
+                                              {"system", "miui_refresh_rate"},
+                                              {"secure", "miui_refresh_rate"}};
+        return keys;
+    }
+
+    static std::string command(const Key& key, const std::string& value) {
+        return "/system/bin/cmd settings put " + key.ns + " " + key.name + " " + value;
+    }
+
+    static std::string run(const char* cmd) {  //执行并读取全部输出
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
+        if (!pipe) {
+            return "";
+        }
+        std::string output;
+        char buffer[256];
+        while (fgets(buffer, sizeof(buffer), pipe.get())) {
+            output += buffer;
+        }
+        return output;
+    }
+
+    static std::string fingerprint() {
+        std::string fp = run("getprop ro.build.fingerprint");
+        fp.erase(fp.find_last_not_of(" \t\r\n") + 1);
+        return fp;
+    }
+
+    /*从dumpsys display中找出当前模式的刷新率：
+      mActiveModeId=2 给出模式id，再在DisplayModeRecord{mMode={id=2, ..., fps=90.0, ...}}中查找
+      找不到时退回DisplayInfo中的renderFrameRate*/
+    static int parseActiveRate(const std::string& output) {
+        std::unordered_map<int, double> modes;
+        size_t pos = 0;
+        while ((pos = output.find("mMode={id=", pos)) != std::string::npos) {
+            pos += 10;
+            int id = atoi(output.c_str() + pos);
+            size_t end = output.find('}', pos);
+            size_t fpsPos = output.find("fps=", pos);
+            if (fpsPos != std::string::npos && fpsPos < end) {
+                modes[id] = atof(output.c_str() + fpsPos + 4);
+            }
+        }
+
+        pos = output.find("mActiveModeId=");
+        if (pos != std::string::npos) {
+            auto it = modes.find(atoi(output.c_str() + pos + 14));
+            if (it != modes.end()) {
+                return static_cast<int>(std::lround(it->second));
+            }
+        }
+
+        pos = output.find("renderFrameRate ");
+        if (pos != std::string::npos) {
+            return static_cast<int>(std::lround(atof(output.c_str() + pos + 16)));
+        }
+        return 0;
+    }
+
+    static int activeRate() {
+        return parseActiveRate(run("dumpsys display"));
+    }
+
+    static bool loadCache(const std::string& path, const std::string& fp, std::vector<Key>& keys) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        try {
+            nlohmann::json data = nlohmann::json::parse(file);
+            if (data.value("fingerprint", "") != fp || !data.contains("keys") || !data["keys"].is_array()) {
+                return false;
+            }
+            if (data["keys"].empty()) {  //此前探测无法判断，不再重复
+                keys = candidates();
+                return true;
+            }
+            std::vector<Key> loaded;
+            for (const auto& item : data["keys"]) {
+                Key key{item.value("namespace", ""), item.value("name", "")};
+                for (const auto& candidate : candidates()) {  //只接受已知的项
+                    if (candidate == key) {
+                        loaded.push_back(key);
+                    }
+                }
+            }
+            if (loaded.empty()) {
+                return false;
+            }
+            keys = loaded;
+            return true;
+        } catch (const std::exception& e) {
+            LOGW("Failed to load %s: %s", path.c_str(), e.what());
+            return false;
+        }
+    }
+
+    static void saveCache(const std::string& path, const std::string& fp, const std::vector<Key>& keys) {
+        nlohmann::json list = nlohmann::json::array();
+        for (const auto& key : keys) {
+            list.push_back({{"namespace", key.ns}, {"name", key.name}});
+        }
+        std::ofstream file(path, std::ios::trunc);
+        if (file.is_open()) {
+            file << nlohmann::json{{"fingerprint", fp}, {"keys", list}}.dump(4);
+        }
+    }
+
+    /*探测：全部写high作为基准，逐项改为low看模式是否跟随；再以low为基准逐项改为high
+      两个方向都试，min_refresh_rate这类只在抬高时起作用的项也能识别
+      返回空表示无法判断(基准本身未生效或被中止)，调用者应继续写入全部项*/
+    static std::vector<Key> probe(int low, int high, const std::atomic<bool>& running) {
+        std::vector<Key> effective;
+        std::string lowStr = std::to_string(low);
+        std::string highStr = std::to_string(high);
+
+        for (const auto& [base, test, baseRate, testRate] :
+             {std::make_tuple(highStr, lowStr, high, low), std::make_tuple(lowStr, highStr, low, high)}) {
+            write_all(base);
+            if (!settle(baseRate, running)) {
+                LOGW("RefreshRateProbe: baseline %d not reached, skipped", baseRate);
+                write_all(highStr);
+                return {};
+            }
+
+            for (const auto& key : candidates()) {
+                if (!running.load(std::memory_order_relaxed)) {
+                    write_all(highStr);
+                    return {};
+                }
+                bool known = false;
+                for (const auto& found : effective) {
+                    known = known || found == key;
+                }
+                if (known) {
+                    continue;
+                }
+
+                run((command(key, test) + " 2>&1").c_str());
+                if (settle(testRate, running)) {
+                    LOGD("RefreshRateProbe: %s/%s is effective", key.ns.c_str(), key.name.c_str());
+                    effective.push_back(key);
+                }
+                run((command(key, base) + " 2>&1").c_str());
+                settle(baseRate, running);
+            }
+        }
+
+        write_all(highStr);  //未生效的项也保持一致的值
+        return effective;
+    }
+
+private:
+    static void write_all(const std::string& value) {
+        std::string cmd;
+        for (const auto& key : candidates()) {
+            cmd += command(key, value) + " >/dev/null 2>&1; ";
+        }
+        run(cmd.c_str());
+    }
+
+    static bool settle(int rate, const std::atomic<bool>& running) {  //等待当前模式变为rate，最多约1.5秒
+        for (int i = 0; i < 5 && running.load(std::memory_order_relaxed); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            if (activeRate() == rate) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
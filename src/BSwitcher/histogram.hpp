@@ -0,0 +1,84 @@
+/* 滚动延迟直方图 */
+/* 按2的幂分桶(毫秒)，保留当前与上一个窗口，读取时合并，较旧的数据随窗口滚动淘汰 */
+/* 线程安全，写入与读取可在不同线程 */
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+class RollingHistogram {
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const int BUCKETS = 16;  //[0,1) [1,2) [2,4) ... [16384,∞)
+
+    struct Window {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t count = 0;
+        double sum_ms = 0.0;
+        double max_ms = 0.0;
+    };
+
+    std::chrono::milliseconds window_;
+    Window current_, previous_;
+    clock::time_point start_ = clock::now();
+    mutable std::mutex mutex_;
+
+    void roll(clock::time_point now) {
+        if (now - start_ < window_) {
+            return;
+        }
+        previous_ = (now - start_ < 2 * window_) ? current_ : Window{};  //超过两个窗口没有数据时全部丢弃
+        current_ = Window{};
+        start_ = now;
+    }
+
+    static int bucket(double ms) {
+        int index = 0;
+        for (double bound = 1.0; ms >= bound && index < BUCKETS - 1; bound *= 2.0) {
+            ++index;
+        }
+        return index;
+    }
+
+public:
+    explicit RollingHistogram(std::chrono::milliseconds window = std::chrono::minutes(10))
+        : window_(window) {}
+
+    void add(double ms) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        roll(clock::now());
+        current_.counts[bucket(ms)]++;
+        current_.count++;
+        current_.sum_ms += ms;
+        if (ms > current_.max_ms) {
+            current_.max_ms = ms;
+        }
+    }
+
+    nlohmann::json toJson() {  //{count, avg_ms, max_ms, buckets:[{le_ms, count}]}，只列出非空的桶
+        std::lock_guard<std::mutex> lock(mutex_);
+        roll(clock::now());
+
+        uint64_t count = current_.count + previous_.count;
+        nlohmann::json buckets = nlohmann::json::array();
+        double bound = 1.0;
+        for (int i = 0; i < BUCKETS; ++i, bound *= 2.0) {
+            uint64_t n = current_.counts[i] + previous_.counts[i];
+            if (n != 0) {
+                buckets.push_back({{"le_ms", i == BUCKETS - 1 ? -1.0 : bound}, {"count", n}});  //-1为无上限
+            }
+        }
+        return {{"count", count},
+                {"avg_ms", count ? (current_.sum_ms + previous_.sum_ms) / count : 0.0},
+                {"max_ms", std::max(current_.max_ms, previous_.max_ms)},
+                {"window_s", std::chrono::duration_cast<std::chrono::seconds>(window_).count()},
+                {"buckets", buckets}};
+    }
+};
+
+#endif
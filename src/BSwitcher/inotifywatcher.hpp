@@ -1,56 +1,154 @@
-/* inotify 监听器。只管发生不管内容 */
+/* inotify 监听器 */
+/* 首个事件立即通知，随后的事件在尾随窗口内合并 */
+/* 事件按路径解码：可取回变化路径的位图，也可为单个路径注册回调 */
+/* 每次通知递增代数，多个订阅者各自记录已看到的代数，互不抢占事件 */
+/* 不持有线程，inotify与定时器都挂在共享的Reactor上 */
+/* 文件被删除或重建后，通过父目录监听与定时重试重新挂上监听 */
+/* 统计各路径的事件速率，事件风暴时自动加宽合并窗口，平静后恢复 */
 #ifndef INOTIFY_WATCHER
 #define INOTIFY_WATCHER
 
 #include "Alog.hpp"
+#include "reactor.hpp"
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cmath>
 #include <cstring>
+#include <functional>
+#include <libgen.h>
 #include <mutex>
 #include <string>
 #include <sys/epoll.h>
-#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/timerfd.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 class FileWatcher {
+public:
+    //在Reactor线程中对每个事件立即调用，不经过合并窗口。name为目录监听时的子项名
+    using EventCallback = std::function<void(const std::string& path, uint32_t mask, const std::string& name)>;
+
+    struct Subscription {  //订阅者自己持有，记录已看到的代数
+        uint64_t seen = 0;
+    };
+
+    struct PathStats {
+        std::string path;
+        bool watching = false;
+        uint64_t events = 0;
+        double rate = 0.0;  //事件/秒，指数滑动平均
+    };
+
+    struct Stats {  //供外部查看的快照
+        std::string name;
+        int window_ms = 0;     //配置的合并窗口
+        int effective_ms = 0;  //当前实际使用的窗口
+        bool storm = false;
+        unsigned int storms = 0;  //进入风暴的次数
+        uint64_t events = 0;
+        uint64_t notifications = 0;
+        double rate = 0.0;
+        size_t lost = 0;
+        unsigned int invalidations = 0;
+        unsigned int recoveries = 0;
+        std::vector<PathStats> paths;
+    };
+
 private:
     std::atomic<bool> running_{false};
-    std::thread monitor_thread_;
 
     std::mutex event_mutex_;
     std::condition_variable event_cv_;
-    std::atomic<bool> event_pending_{true};
+    std::atomic<uint64_t> generation_{0};                //每次通知递增
+    std::array<std::atomic<uint64_t>, 64> path_gen_{};  //各路径位最后一次变化时的代数
+    uint64_t pending_paths_{0};                          //尚未发布的变化路径，只在Reactor线程访问
+    Subscription default_sub_;                           //供不需要订阅的wait()使用
 
-    int epoll_fd{-1};
     int inotify_fd{-1};
-    int wakeup_fd{-1};
-    int sleeptime_ms_;
+    int timer_fd{-1};         //尾随窗口定时器
+    int coalesce_ms_;         //合并窗口长度
+    bool coalescing_{false};  //窗口是否打开
+    bool trailing_{false};    //窗口内是否又来了事件
     uint32_t event_mask_;
     std::vector<int> watch_descriptors;
     std::vector<std::string> watched_files;
+    std::unordered_map<int, std::vector<size_t>> wd_paths_;  // wd -> watched_files下标，同一inode会共用wd
+    std::unordered_map<std::string, EventCallback> callbacks_;
     bool initialized{false};
 
-    static const int MAX_EVENTS = 32;
+    static constexpr uint32_t SELF_EVENTS = IN_DELETE_SELF | IN_MOVE_SELF;  //总是监听，用于发现失效的监听
+    static constexpr int RETRY_MIN_MS = 1000;
+    static constexpr int RETRY_MAX_MS = 30000;
+
+    int recover_fd_{-1};                              //父目录监听，与主inotify分开，避免同一inode的掩码互相覆盖
+    int retry_fd_{-1};                                //重试定时器，cgroupfs不产生IN_CREATE时依靠它
+    int retry_ms_{0};                                 //当前重试间隔，指数退避
+    std::vector<bool> lost_;                          //监听已失效的路径
+    std::unordered_map<int, std::string> parent_wds_;  //父目录wd -> 目录
+    std::atomic<size_t> active_watches_{0};
+    std::atomic<size_t> lost_count_{0};
+    std::atomic<unsigned int> invalidations_{0};  //监听失效次数
+    std::atomic<unsigned int> recoveries_{0};     //重新挂上的次数
+
+    using clock = std::chrono::steady_clock;
+    static constexpr double RATE_TAU_S = 1.0;  //速率平均的时间常数
+
+    struct RateMeter {  //按时间衰减的事件速率
+        uint64_t count = 0;
+        double rate = 0.0;
+        clock::time_point last{};
+
+        double at(clock::time_point now) const {
+            if (count == 0) {
+                return 0.0;
+            }
+            double dt = std::chrono::duration<double>(now - last).count();
+            return rate * std::exp(-dt / RATE_TAU_S);
+        }
+
+        void hit(clock::time_point now) {
+            rate = at(now) + 1.0 / RATE_TAU_S;
+            last = now;
+            count++;
+        }
+    };
+
+    std::string name_{"watcher"};
+    double storm_rate_{50.0};  //超过该速率(事件/秒)视为风暴，<=0时不调整窗口
+    int storm_max_ms_{1000};   //风暴时窗口上限
+    mutable std::mutex stats_mutex_;
+    RateMeter total_meter_;
+    std::vector<RateMeter> path_meters_;
+    bool storm_{false};
+    unsigned int storms_{0};
+    int effective_ms_{0};
+    uint64_t notifications_{0};
+
+    static std::mutex& registry_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<FileWatcher*>& registry() {  //已初始化的监听器，供统计查看
+        static std::vector<FileWatcher*> watchers;
+        return watchers;
+    }
 
 public:
     FileWatcher(const std::vector<std::string>& file_paths = {},
-                int sleeptime_ms = 100,
+                int coalesce_ms = 100,
                 uint32_t event_mask = IN_MODIFY)  //默认监听修改事件
-        : sleeptime_ms_(sleeptime_ms), event_mask_(event_mask) {
+        : coalesce_ms_(coalesce_ms), event_mask_(event_mask) {
 
         if (!file_paths.empty()) {
             watched_files = file_paths;
         }
-
-        wakeup_fd = eventfd(0, EFD_NONBLOCK);
-        if (wakeup_fd < 0) {
-            LOGE("Failed to create eventfd: %s", strerror(errno));
-        }
     }
 
     ~FileWatcher() {
@@ -60,7 +158,7 @@ public:
 
     void setFilesToWatch(const std::vector<std::string>& file_paths) {
         if (initialized) {
-            LOGW("Cannot define while the monitoring thread is running.");
+            LOGW("Cannot define while the watcher is active.");
             return;
         }
         watched_files = file_paths;
@@ -68,7 +166,7 @@ public:
 
     void addFileToWatch(const std::string& file_path) {
         if (initialized) {
-            LOGW("Cannot define while the monitoring thread is running.");
+            LOGW("Cannot define while the watcher is active.");
             return;
         }
         watched_files.push_back(file_path);
@@ -76,7 +174,7 @@ public:
 
     void setEventMask(uint32_t event_mask) {
         if (initialized) {
-            LOGW("Cannot change event mask while the monitoring thread is running.");
+            LOGW("Cannot change event mask while the watcher is active.");
             return;
         }
         event_mask_ = event_mask;
@@ -85,7 +183,7 @@ public:
 
     void addEventType(uint32_t event_type) {
         if (initialized) {
-            LOGW("Cannot change event mask while the monitoring thread is running.");
+            LOGW("Cannot change event mask while the watcher is active.");
             return;
         }
         event_mask_ |= event_type;
@@ -94,7 +192,7 @@ public:
 
     void removeEventType(uint32_t event_type) {
         if (initialized) {
-            LOGW("Cannot change event mask while the monitoring thread is running.");
+            LOGW("Cannot change event mask while the watcher is active.");
             return;
         }
         event_mask_ &= ~event_type;
@@ -105,6 +203,132 @@ public:
         return event_mask_;
     }
 
+    void setCallback(const std::string& file_path, EventCallback callback) {
+        if (initialized) {
+            LOGW("Cannot set callback while the watcher is active.");
+            return;
+        }
+        callbacks_[file_path] = std::move(callback);
+    }
+
+    static constexpr uint64_t pathBit(size_t index) {  //watched_files下标对应的位，超出64个的路径共用最高位
+        return 1ULL << std::min<size_t>(index, 63);
+    }
+
+    Subscription subscribe() const {  //从当前代数开始订阅
+        return Subscription{generation_.load(std::memory_order_acquire)};
+    }
+
+    bool poll(Subscription& sub, uint64_t* dirty = nullptr) {  //非阻塞检查
+        uint64_t gen = generation_.load(std::memory_order_acquire);
+        if (gen == sub.seen) {
+            return false;
+        }
+        if (dirty) {
+            *dirty = collect_dirty(sub.seen);
+        }
+        sub.seen = gen;
+        return true;
+    }
+
+    void kick() {  //不带路径地唤醒所有等待者，订阅者看到的位图为0
+        if (!running_) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(event_mutex_);
+            generation_.fetch_add(1, std::memory_order_acq_rel);
+        }
+        event_cv_.notify_all();
+    }
+
+    bool wait(Subscription& sub, int timeout_ms = -1, uint64_t* dirty = nullptr) {  //阻塞到有新代数或超时
+        if (!initialized || !running_) {
+            return false;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(event_mutex_);
+            auto advanced = [this, &sub]() { return generation_.load(std::memory_order_acquire) != sub.seen; };
+
+            if (timeout_ms > 0) {
+                if (!event_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), advanced)) {
+                    return false;
+                }
+            } else {
+                event_cv_.wait(lock, advanced);
+            }
+        }
+
+        return poll(sub, dirty);
+    }
+
+    void setCoalesceWindow(int coalesce_ms) {
+        if (initialized) {
+            LOGW("Cannot change coalesce window while the watcher is active.");
+            return;
+        }
+        coalesce_ms_ = coalesce_ms;
+    }
+
+    int getCoalesceWindow() const {
+        return coalesce_ms_;
+    }
+
+    void setName(const std::string& name) {
+        name_ = name;
+    }
+
+    const std::string& getName() const {
+        return name_;
+    }
+
+    void setStormDamping(double rate_threshold, int max_window_ms) {  //速率阈值与窗口上限
+        if (initialized) {
+            LOGW("Cannot change storm damping while the watcher is active.");
+            return;
+        }
+        storm_rate_ = rate_threshold;
+        storm_max_ms_ = max_window_ms;
+    }
+
+    Stats getStats() const {
+        Stats stats;
+        auto now = clock::now();
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats.name = name_;
+            stats.window_ms = coalesce_ms_;
+            stats.effective_ms = effective_ms_;
+            stats.storm = storm_;
+            stats.storms = storms_;
+            stats.events = total_meter_.count;
+            stats.notifications = notifications_;
+            stats.rate = total_meter_.at(now);
+            for (size_t i = 0; i < watched_files.size() && i < path_meters_.size(); ++i) {
+                PathStats path;
+                path.path = watched_files[i];
+                path.watching = i < lost_.size() && !lost_[i];
+                path.events = path_meters_[i].count;
+                path.rate = path_meters_[i].at(now);
+                stats.paths.push_back(std::move(path));
+            }
+        }
+        stats.lost = lost_count_.load();
+        stats.invalidations = invalidations_.load();
+        stats.recoveries = recoveries_.load();
+        return stats;
+    }
+
+    static std::vector<Stats> getAllStats() {  //所有活动监听器的统计
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        std::vector<Stats> result;
+        for (const FileWatcher* watcher : registry()) {
+            result.push_back(watcher->getStats());
+        }
+        return result;
+    }
+
     std::string getEventMaskDescription() const {
         std::vector<std::string> events;
 
@@ -149,62 +373,41 @@ public:
             event_mask_ = IN_MODIFY;
         }
 
-        if (wakeup_fd < 0) {
-            wakeup_fd = eventfd(0, EFD_NONBLOCK);
-            if (wakeup_fd < 0) {
-                LOGE("Failed to create eventfd: %s", strerror(errno));
-                return false;
-            }
-        }
-
-        epoll_fd = epoll_create1(0);
-        if (epoll_fd < 0) {
-            LOGE("Failed to create epoll instance: %s", strerror(errno));
-            return false;
-        }
-
-        inotify_fd = inotify_init1(IN_NONBLOCK);
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
         if (inotify_fd < 0) {
             LOGE("Failed to initialize inotify: %s", strerror(errno));
-            close(epoll_fd);
-            epoll_fd = -1;
             return false;
         }
 
-        struct epoll_event event;
-        event.events = EPOLLIN;
-        event.data.fd = inotify_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event) < 0) {
-            LOGE("Failed to add inotify fd: %s", strerror(errno));
-            close(inotify_fd);
-            close(epoll_fd);
-            inotify_fd = -1;
-            epoll_fd = -1;
-            return false;
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) {
+            LOGW("Failed to create timerfd: %s, events will not be coalesced", strerror(errno));
         }
 
-        event.events = EPOLLIN;
-        event.data.fd = wakeup_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &event) < 0) {
-            LOGE("Failed to add wakeup fd to epoll: %s", strerror(errno));
-            close(inotify_fd);
-            close(epoll_fd);
-            inotify_fd = -1;
-            epoll_fd = -1;
-            return false;
+        recover_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        retry_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (recover_fd_ < 0 || retry_fd_ < 0) {
+            LOGW("Failed to create recovery fds: %s, lost watches will not be restored", strerror(errno));
         }
 
         bool at_least_one_valid = false;
-        for (const auto& file_path : watched_files) {
-            int wd = inotify_add_watch(inotify_fd, file_path.c_str(), event_mask_);
-            if (wd < 0) {
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            lost_.assign(watched_files.size(), false);
+            path_meters_.assign(watched_files.size(), RateMeter());
+            total_meter_ = RateMeter();
+            storm_ = false;
+            effective_ms_ = coalesce_ms_;
+        }
+        bool any_lost = false;
+        for (size_t i = 0; i < watched_files.size(); ++i) {
+            const auto& file_path = watched_files[i];
+            if (!add_path(i)) {
                 LOGW("Failed to watch file: %s, error: %s", file_path.c_str(), strerror(errno));
+                lost_[i] = true;
+                any_lost = true;
                 continue;
             }
-
-            LOGD("Successfully registered inotify for: %s with watch descriptor: %d, events: 0x%08X",
-                 file_path.c_str(), wd, event_mask_);
-            watch_descriptors.push_back(wd);
             at_least_one_valid = true;
         }
 
@@ -214,11 +417,24 @@ public:
             return false;
         }
 
+        /*交给Reactor之后监听与重试状态只在Reactor线程中修改，在此之前完成设置与统计*/
+        if (any_lost) {  //启动时不存在的路径稍后再试
+            schedule_retry();
+        }
+        update_counts();
+        size_t watch_count = watch_descriptors.size();
+        if (!start_monitor()) {
+            cleanup();
+            return false;
+        }
         initialized = true;
-        start_monitor_thread();
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(this);
+        }
 
         LOGI("Registered inotify for %zu files with event mask: %s",
-             watch_descriptors.size(), getEventMaskDescription().c_str());
+             watch_count, getEventMaskDescription().c_str());
         return true;
     }
 
@@ -238,39 +454,26 @@ public:
         return initialize();
     }
 
-    bool wait(int timeout_ms = -1, int delay_clean_ms = 0) {  //主等待函数
-        if (!initialized || !running_) {
-            return false;
-        }
-
-        bool has_event = false;
-        {
-            std::unique_lock<std::mutex> lock(event_mutex_);
-
-            if (timeout_ms > 0) {
-                has_event = event_cv_.wait_for(lock,
-                                               std::chrono::milliseconds(timeout_ms),
-                                               [this]() { return event_pending_.load(std::memory_order_relaxed); });
-            } else {
-                event_cv_.wait(lock, [this]() { return event_pending_.load(std::memory_order_relaxed); });
-                has_event = true;
-            }
-        }
-
-        if (!has_event) {
+    bool wait(int timeout_ms = -1, int delay_clean_ms = 0) {  //单一消费者的简便写法
+        if (!wait(default_sub_, timeout_ms)) {
             return false;
         }
 
         if (delay_clean_ms > 0) {
             std::this_thread::sleep_for(std::chrono::milliseconds(delay_clean_ms));
+            poll(default_sub_);  //延迟期间的事件一并消费
         }
-
-        event_pending_.store(false,std::memory_order_relaxed);
-
         return true;
     }
 
     void cleanup() {
+        stop();  //先停止分发，移除监听产生的IN_IGNORED不会再触发恢复
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            auto& watchers = registry();
+            watchers.erase(std::remove(watchers.begin(), watchers.end(), this), watchers.end());
+        }
+
         if (!watch_descriptors.empty()) {
             LOGI("Cleaning up FileWatcher resources");
 
@@ -283,12 +486,23 @@ public:
             }
             watch_descriptors.clear();
         }
+        wd_paths_.clear();
 
-        stop(); //关闭监控
-
-        if (epoll_fd >= 0) {
-            close(epoll_fd);
-            epoll_fd = -1;
+        parent_wds_.clear();
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            lost_.clear();
+        }
+        retry_ms_ = 0;
+        active_watches_.store(0);
+        lost_count_.store(0);
+        if (recover_fd_ >= 0) {  //关闭时父目录监听随之释放
+            close(recover_fd_);
+            recover_fd_ = -1;
+        }
+        if (retry_fd_ >= 0) {
+            close(retry_fd_);
+            retry_fd_ = -1;
         }
 
         if (inotify_fd >= 0) {
@@ -296,9 +510,9 @@ public:
             inotify_fd = -1;
         }
 
-        if (wakeup_fd >= 0) {
-            close(wakeup_fd);
-            wakeup_fd = -1;
+        if (timer_fd >= 0) {
+            close(timer_fd);
+            timer_fd = -1;
         }
 
         initialized = false;
@@ -306,7 +520,19 @@ public:
     }
 
     size_t getWatchedFileCount() const {
-        return watch_descriptors.size();
+        return active_watches_.load();
+    }
+
+    size_t getLostFileCount() const {  //当前失效、等待恢复的路径数
+        return lost_count_.load();
+    }
+
+    unsigned int getInvalidationCount() const {
+        return invalidations_.load();
+    }
+
+    unsigned int getRecoveryCount() const {
+        return recoveries_.load();
     }
 
     size_t getConfiguredFileCount() const {
@@ -327,120 +553,361 @@ private:
 
     void stop() {
         if (running_.exchange(false)) {
-            LOGD("Stopping FileWatcher monitor thread...");
+            LOGD("Stopping FileWatcher...");
 
-            if (wakeup_fd >= 0) {
-                uint64_t value = 1;
-                ssize_t result = write(wakeup_fd, &value, sizeof(value));
-                if (result < 0) {
-                    LOGW("Failed to write to wakeup_fd: %s", strerror(errno));
-                }
-            }
+            Reactor::instance().remove(inotify_fd);  //返回后回调不会再执行
+            Reactor::instance().remove(timer_fd);
+            Reactor::instance().remove(recover_fd_);
+            Reactor::instance().remove(retry_fd_);
 
             {
                 std::lock_guard<std::mutex> lock(event_mutex_);
-                event_pending_.store(true,std::memory_order_relaxed);  //确保wait不会无限阻塞
+                generation_.fetch_add(1, std::memory_order_acq_rel);  //确保wait不会无限阻塞
             }
-            event_cv_.notify_one();
+            event_cv_.notify_all();
+        }
+    }
 
-            if (monitor_thread_.joinable()) {
-                monitor_thread_.join();
-                LOGD("FileWatcher monitor thread stopped");
-            }
+    static bool arm_timer(int fd, int ms) {  //单次定时
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+        if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+            LOGW("Failed to arm timer: %s", strerror(errno));
+            return false;
         }
+        return true;
     }
 
-    void start_monitor_thread() {
-        running_.store(true);
-        monitor_thread_ = std::thread(&FileWatcher::monitor_loop, this);
+    static void disarm_timer(int fd) {
+        if (fd >= 0) {
+            struct itimerspec spec = {};
+            timerfd_settime(fd, 0, &spec, nullptr);
+        }
     }
 
-    void monitor_loop() {
-        LOGD("FileWatcher monitor thread started");
-        const size_t buffer_size = 4096;
-        char buffer[buffer_size];
-        struct epoll_event events[MAX_EVENTS];
+    int window_ms() {  //按当前事件速率决定窗口长度
+        if (coalesce_ms_ <= 0) {
+            return coalesce_ms_;
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        double rate = total_meter_.at(clock::now());
+        if (storm_rate_ <= 0 || rate <= storm_rate_) {
+            if (storm_) {
+                LOGD("%s: event storm over, window back to %dms", name_.c_str(), coalesce_ms_);
+            }
+            storm_ = false;
+            effective_ms_ = coalesce_ms_;
+            return effective_ms_;
+        }
+
+        int upper = std::max(storm_max_ms_, coalesce_ms_);
+        effective_ms_ = std::min(upper, static_cast<int>(coalesce_ms_ * rate / storm_rate_));
+        effective_ms_ = std::max(effective_ms_, coalesce_ms_);
+        if (!storm_) {
+            storm_ = true;
+            storms_++;
+            LOGD("%s: event storm (%.0f/s), widening window to %dms", name_.c_str(), rate, effective_ms_);
+        }
+        return effective_ms_;
+    }
 
-        sigset_t mask;
-        sigfillset(&mask);
-        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+    bool arm_window() {  //打开尾随窗口
+        if (timer_fd < 0 || coalesce_ms_ <= 0) {
+            return false;
+        }
+        return arm_timer(timer_fd, window_ms());
+    }
 
-        event_pending_.store(false,std::memory_order_relaxed);
+    void decode_events(const char* buffer, ssize_t length) {  //解析事件，标记路径并执行回调
+        const char* ptr = buffer;
+        while (ptr + static_cast<ssize_t>(sizeof(struct inotify_event)) <= buffer + length) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + ev->len;
 
-        while (running_.load()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleeptime_ms_));
+            if (ev->mask & IN_Q_OVERFLOW) {  //队列溢出，无法知道具体路径
+                LOGW("inotify queue overflow");
+                pending_paths_ = ~0ULL;
+                continue;
+            }
+
+            if (ev->mask & IN_IGNORED) {  //文件被删除或监听被移除
+                invalidate_watch(ev->wd);
+                continue;
+            }
 
-            int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (ev->mask & IN_MOVE_SELF) {  //被改名后原路径已不是这个inode，主动移除，随后收到IN_IGNORED
+                inotify_rm_watch(inotify_fd, ev->wd);
+            }
 
-            if (!running_.load()) {
-                uint64_t value;
-                ssize_t result = read(wakeup_fd, &value, sizeof(value));
-                LOGD("inotify terminated");
-                break;
+            auto it = wd_paths_.find(ev->wd);
+            if (it == wd_paths_.end()) {
+                continue;
             }
 
-            if (num_events < 0) {
-                if (errno == EINTR) {
-                    LOGD("epoll_wait interrupted by signal");
-                    continue;
+            std::string name = (ev->len > 0) ? std::string(ev->name) : std::string();
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                auto now = clock::now();
+                total_meter_.hit(now);
+                for (size_t index : it->second) {
+                    path_meters_[index].hit(now);
                 }
-                if (errno == EBADF) {
-                    LOGD("epoll terminated abnormally, descriptor invalidated.");
-                    break;
+            }
+            for (size_t index : it->second) {
+                pending_paths_ |= pathBit(index);
+
+                auto cb = callbacks_.find(watched_files[index]);
+                if (cb != callbacks_.end() && cb->second) {
+                    cb->second(watched_files[index], ev->mask, name);
                 }
-                LOGE("epoll_wait() failed in monitor thread: %s", strerror(errno));
-                break;
             }
+        }
+    }
 
-            if (num_events == 0) {
-                LOGW("epoll_wait returned 0 events unexpectedly");
+    bool add_path(size_t index) {  //为watched_files[index]添加监听
+        int wd = inotify_add_watch(inotify_fd, watched_files[index].c_str(), event_mask_ | SELF_EVENTS);
+        if (wd < 0) {
+            return false;
+        }
+
+        LOGD("Successfully registered inotify for: %s with watch descriptor: %d, events: 0x%08X",
+             watched_files[index].c_str(), wd, event_mask_);
+        if (std::find(watch_descriptors.begin(), watch_descriptors.end(), wd) == watch_descriptors.end()) {
+            watch_descriptors.push_back(wd);
+        }
+        auto& paths = wd_paths_[wd];
+        if (std::find(paths.begin(), paths.end(), index) == paths.end()) {
+            paths.push_back(index);
+        }
+        return true;
+    }
+
+    void update_counts() {
+        active_watches_.store(watch_descriptors.size());
+        lost_count_.store(static_cast<size_t>(std::count(lost_.begin(), lost_.end(), true)));
+    }
+
+    void invalidate_watch(int wd) {  //监听失效，记录路径并尝试恢复
+        auto it = wd_paths_.find(wd);
+        if (it == wd_paths_.end()) {
+            return;
+        }
+        std::vector<size_t> paths = std::move(it->second);
+        wd_paths_.erase(it);
+        watch_descriptors.erase(std::remove(watch_descriptors.begin(), watch_descriptors.end(), wd),
+                                watch_descriptors.end());
+
+        for (size_t index : paths) {
+            LOGW("Watch on %s invalidated", watched_files[index].c_str());
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            lost_[index] = true;
+            pending_paths_ |= pathBit(index);
+        }
+        invalidations_.fetch_add(1);
+
+        retry_ms_ = 0;  //重建通常很快，先立即试一次
+        if (!try_recover()) {
+            schedule_retry();
+        }
+        update_counts();
+    }
+
+    bool try_recover() {  //重新添加失效的路径，返回是否已全部恢复
+        bool all_restored = true;
+        for (size_t i = 0; i < lost_.size(); ++i) {
+            if (!lost_[i]) {
                 continue;
             }
+            if (!add_path(i)) {
+                all_restored = false;
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                lost_[i] = false;
+            }
+            pending_paths_ |= pathBit(i);  //恢复期间可能错过了变化
+            recoveries_.fetch_add(1);
+            LOGI("Watch on %s restored", watched_files[i].c_str());
+        }
+
+        if (all_restored) {
+            for (const auto& [pwd, dir] : parent_wds_) {
+                inotify_rm_watch(recover_fd_, pwd);
+            }
+            parent_wds_.clear();
+            retry_ms_ = 0;
+            disarm_timer(retry_fd_);
+        }
+        update_counts();
+        return all_restored;
+    }
 
-            bool notify_main_thread = false;
-            bool should_exit = false;
-
-            for (int i = 0; i < num_events; ++i) {
-                int ready_fd = events[i].data.fd;
-
-                if (ready_fd == wakeup_fd) {
-                    uint64_t value;
-                    ssize_t result = read(wakeup_fd, &value, sizeof(value));
-                    break;
-                } else if (ready_fd == inotify_fd && (events[i].events & EPOLLIN)) {
-                    ssize_t total_read = 0;
-                    ssize_t length;
-
-                    while ((length = read(inotify_fd, buffer, buffer_size)) > 0) {
-                        total_read += length;
-                    }
-
-                    if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EBADF) {
-                        LOGE("Error reading inotify events: %s", strerror(errno));
-                        should_exit = true;
-                        break;
-                    }
-
-                    if (total_read > 0) {
-                        notify_main_thread = true;
-                    }
+    void schedule_retry() {  //监听失效路径的父目录，并按退避间隔定时重试
+        if (recover_fd_ < 0 || retry_fd_ < 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < lost_.size(); ++i) {
+            if (!lost_[i]) {
+                continue;
+            }
+            std::vector<char> buf(watched_files[i].begin(), watched_files[i].end());
+            buf.push_back('\0');
+            std::string dir = dirname(buf.data());
+            int pwd = inotify_add_watch(recover_fd_, dir.c_str(), IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+            if (pwd >= 0) {
+                parent_wds_[pwd] = dir;
+            }
+        }
+
+        retry_ms_ = retry_ms_ > 0 ? std::min(retry_ms_ * 2, RETRY_MAX_MS) : RETRY_MIN_MS;
+        arm_timer(retry_fd_, retry_ms_);
+    }
+
+    void on_parent_event() {  //父目录下有新建项，可能是被重建的文件
+        const size_t buffer_size = 4096;
+        alignas(struct inotify_event) char buffer[buffer_size];
+        ssize_t length;
+        bool any = false;
+
+        while ((length = read(recover_fd_, buffer, buffer_size)) > 0) {
+            const char* ptr = buffer;
+            while (ptr + static_cast<ssize_t>(sizeof(struct inotify_event)) <= buffer + length) {
+                const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(ptr);
+                ptr += sizeof(struct inotify_event) + ev->len;
+                if (ev->mask & IN_IGNORED) {  //父目录本身也没了，交给定时重试
+                    parent_wds_.erase(ev->wd);
+                } else {
+                    any = true;
                 }
             }
+        }
+
+        if (any && try_recover()) {
+            signal();
+        }
+    }
 
-            if (should_exit) {
-                break;
+    void on_retry() {
+        uint64_t expirations;
+        ssize_t result = read(retry_fd_, &expirations, sizeof(expirations));
+        (void)result;
+
+        if (try_recover()) {
+            signal();
+        } else {
+            schedule_retry();
+        }
+    }
+
+    uint64_t collect_dirty(uint64_t since) const {  //since之后变化过的路径
+        uint64_t dirty = 0;
+        for (size_t bit = 0; bit < path_gen_.size(); ++bit) {
+            if (path_gen_[bit].load(std::memory_order_acquire) > since) {
+                dirty |= (1ULL << bit);
             }
+        }
+        return dirty;
+    }
 
-            if (notify_main_thread && running_.load()) {
-                {
-                    std::lock_guard<std::mutex> lock(event_mutex_);
-                    event_pending_.store(true,std::memory_order_relaxed);   // 触发事件
+    bool start_monitor() {  //把fd交给Reactor
+        coalescing_ = false;
+        trailing_ = false;
+        pending_paths_ = 0;
+        default_sub_ = subscribe();
+        running_.store(true);
+
+        if (!Reactor::instance().add(inotify_fd, EPOLLIN, [this](uint32_t) { on_inotify(); })) {
+            running_.store(false);
+            return false;
+        }
+        if (timer_fd >= 0 && !Reactor::instance().add(timer_fd, EPOLLIN, [this](uint32_t) { on_timer(); })) {
+            LOGW("Failed to register coalesce timer, events will not be coalesced");
+            close(timer_fd);
+            timer_fd = -1;
+        }
+        if (recover_fd_ >= 0 && retry_fd_ >= 0 &&
+            !(Reactor::instance().add(recover_fd_, EPOLLIN, [this](uint32_t) { on_parent_event(); }) &&
+              Reactor::instance().add(retry_fd_, EPOLLIN, [this](uint32_t) { on_retry(); }))) {
+            LOGW("Failed to register recovery fds, lost watches will not be restored");
+            Reactor::instance().remove(recover_fd_);
+            close(recover_fd_);
+            close(retry_fd_);
+            recover_fd_ = -1;
+            retry_fd_ = -1;
+            parent_wds_.clear();  //随recover_fd_一并失效
+            retry_ms_ = 0;
+        }
+        return true;
+    }
+
+    void notify_waiters() {
+        if (!running_.load()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(event_mutex_);
+            uint64_t gen = generation_.load(std::memory_order_relaxed) + 1;
+            for (size_t bit = 0; bit < path_gen_.size(); ++bit) {  //先发布路径，再发布代数
+                if (pending_paths_ & (1ULL << bit)) {
+                    path_gen_[bit].store(gen, std::memory_order_release);
                 }
-                event_cv_.notify_one();
             }
+            pending_paths_ = 0;
+            generation_.store(gen, std::memory_order_release);  // 触发事件
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            notifications_++;
+        }
+        event_cv_.notify_all();
+    }
+
+    void on_timer() {  //窗口结束
+        uint64_t expirations;
+        ssize_t result = read(timer_fd, &expirations, sizeof(expirations));
+        (void)result;
+
+        if (trailing_) {  //窗口内有新事件，补发一次并继续合并
+            trailing_ = false;
+            arm_window();
+            notify_waiters();
+        } else {
+            coalescing_ = false;
+        }
+    }
+
+    void on_inotify() {
+        const size_t buffer_size = 4096;
+        alignas(struct inotify_event) char buffer[buffer_size];
+        ssize_t total_read = 0;
+        ssize_t length;
+
+        while ((length = read(inotify_fd, buffer, buffer_size)) > 0) {
+            total_read += length;
+            decode_events(buffer, length);
         }
 
-        LOGD("FileWatcher monitor thread exited");
+        if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EBADF) {
+            LOGE("Error reading inotify events: %s", strerror(errno));
+        }
+
+        if (total_read <= 0) {
+            return;
+        }
+        signal();
+    }
+
+    void signal() {  //按合并窗口通知等待者
+        if (coalescing_) {  //窗口内的事件推迟到窗口结束
+            trailing_ = true;
+        } else {  //首个事件立即通知
+            coalescing_ = arm_window();
+            notify_waiters();
+        }
     }
 };
 
@@ -0,0 +1,636 @@
+/* evdev 触摸读取 */
+/* 直接读取/dev/input/event*的input_event，按BTN_TOUCH与ABS_MT_TRACKING_ID判断手指按下与抬起 */
+/* 不持有线程与epoll，设备fd注册到调用者的epoll中，由调用者分发 */
+/* 按EVIOCGBIT/EVIOCGPROP区分设备，只读取触摸屏，手写笔与键盘可选 */
+/* 记录触点最近的位置，抬起时估计离手速度(屏幕/秒)，用于判断是点击还是滑动 */
+/* 以inotify监听目录，外接键盘、手写笔或重新注册的触摸驱动在运行中加入与移除 */
+#ifndef INPUT_READER_HPP
+#define INPUT_READER_HPP
+
+#include "Alog.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+class InputReader {
+public:
+    enum class Change {
+        None,
+        Down,  //从无触点变为有触点
+        Up,    //最后一个触点抬起
+    };
+
+    enum class DeviceClass {
+        Touchscreen,
+        Stylus,
+        Keyboard,
+        Other,  //传感器、霍尔、音量键等
+    };
+
+    struct DeviceStats {
+        std::string path;
+        std::string name;
+        DeviceClass cls = DeviceClass::Other;
+        bool monitored = false;
+        uint64_t wakeups = 0;   //读取次数
+        uint64_t boosts = 0;    //由该设备触发的升高
+        uint64_t spurious = 0;  //升高后很快抬起，可能是误触
+    };
+
+    static const char* className(DeviceClass cls) {
+        switch (cls) {
+        case DeviceClass::Touchscreen:
+            return "touchscreen";
+        case DeviceClass::Stylus:
+            return "stylus";
+        case DeviceClass::Keyboard:
+            return "keyboard";
+        default:
+            return "other";
+        }
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static const int MAX_SLOTS = 64;
+    static constexpr auto SPURIOUS_TIME = std::chrono::milliseconds(40);  //短于此的触摸视为误触
+    static constexpr int MAX_TRACKED = 10;                                 //只为前几个slot计算速度
+    static constexpr int TRACK_SAMPLES = 8;
+    static constexpr int64_t VELOCITY_WINDOW_US = 100000;  //用抬起前100ms内的移动估计速度
+    static constexpr int64_t STILL_US = 50000;             //抬起前停顿超过50ms视为速度为0
+
+    struct Axis {  //坐标归一化到0~1
+        int min = 0;
+        int range = 0;
+
+        float normalize(int value) const {
+            return range > 0 ? static_cast<float>(value - min) / range : 0.0f;
+        }
+    };
+
+    struct Sample {
+        float x, y;
+        int64_t us;
+    };
+
+    struct Track {  //单个触点最近的位置
+        std::array<Sample, TRACK_SAMPLES> samples{};
+        int count = 0;
+        int head = 0;  //下一个写入的位置
+        int x = 0, y = 0;
+        bool moved = false;
+
+        void reset() {
+            count = 0;
+            head = 0;
+            moved = false;
+        }
+
+        void push(float nx, float ny, int64_t us) {
+            samples[head] = {nx, ny, us};
+            head = (head + 1) % TRACK_SAMPLES;
+            count = std::min(count + 1, TRACK_SAMPLES);
+        }
+
+        float velocity(int64_t lift_us) const {  //屏幕/秒
+            if (count < 2) {
+                return 0.0f;
+            }
+            const Sample& newest = samples[(head + TRACK_SAMPLES - 1) % TRACK_SAMPLES];
+            if (lift_us - newest.us > STILL_US) {
+                return 0.0f;
+            }
+            const Sample* oldest = &newest;
+            for (int i = 2; i <= count; ++i) {
+                const Sample& s = samples[(head + TRACK_SAMPLES - i) % TRACK_SAMPLES];
+                if (newest.us - s.us > VELOCITY_WINDOW_US) {
+                    break;
+                }
+                oldest = &s;
+            }
+            int64_t dt = newest.us - oldest->us;
+            if (dt < 5000) {  //样本过少
+                return 0.0f;
+            }
+            return std::hypot(newest.x - oldest->x, newest.y - oldest->y) * 1000000.0f / dt;
+        }
+    };
+
+    struct Device {
+        int fd = -1;
+        DeviceStats stats;
+        int slot = 0;             //当前ABS_MT_SLOT
+        uint64_t slots = 0;       //有触点的slot
+        bool btn_touch = false;   //BTN_TOUCH状态
+        int keys_down = 0;        //键盘按下的键数
+        bool down = false;        //上一次SYN_REPORT时是否有触点
+        bool dropped = false;     //SYN_DROPPED后丢弃到下一个SYN_REPORT
+        bool boosting = false;    //当前的升高由该设备触发
+        clock::time_point boost_start{};
+        bool multitouch = false;  //有ABS_MT_POSITION时忽略ABS_X/Y
+        bool mono_clock = false;  //事件时间是否为CLOCK_MONOTONIC，可与steady_clock比较
+        int64_t report_us = 0;    //最近一次SYN_REPORT的事件时间
+        Axis ax, ay;
+        std::array<Track, MAX_TRACKED> tracks{};
+    };
+
+    int epoll_fd_{-1};
+    int inotify_fd_{-1};  //监听设备节点的增删
+    std::string dir_;
+    std::unordered_map<int, Device> devices_;  // fd -> 设备，只在工作线程中修改
+    std::vector<DeviceStats> ignored_;         //未读取的设备
+    bool touching_{false};
+    float release_velocity_{0.0f};  //最后抬起的触点的速度
+    clock::time_point down_time_{};  //最近一次按下的时间，优先使用内核的事件时间
+    bool use_stylus_{true};
+    bool use_keyboard_{false};
+    mutable std::mutex stats_mutex_;
+
+    template <size_t N>
+    static bool test_bit(const unsigned long (&bits)[N], int bit) {
+        const size_t width = 8 * sizeof(unsigned long);
+        return static_cast<size_t>(bit) < N * width && ((bits[bit / width] >> (bit % width)) & 1UL);
+    }
+
+    static DeviceClass classify(int fd) {  //按设备能力分类
+        const size_t width = 8 * sizeof(unsigned long);
+        unsigned long ev[EV_MAX / width + 1] = {0};
+        unsigned long abs[ABS_MAX / width + 1] = {0};
+        unsigned long key[KEY_MAX / width + 1] = {0};
+        unsigned long prop[INPUT_PROP_MAX / width + 1] = {0};
+
+        if (ioctl(fd, EVIOCGBIT(0, sizeof(ev)), ev) < 0) {
+            return DeviceClass::Other;
+        }
+        if (test_bit(ev, EV_ABS)) {
+            ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs);
+        }
+        if (test_bit(ev, EV_KEY)) {
+            ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key)), key);
+        }
+        ioctl(fd, EVIOCGPROP(sizeof(prop)), prop);  //旧内核不支持时视为无属性
+
+        bool direct = test_bit(prop, INPUT_PROP_DIRECT);
+        bool multitouch = test_bit(abs, ABS_MT_POSITION_X) || test_bit(abs, ABS_MT_TRACKING_ID);
+        bool pen = test_bit(key, BTN_TOOL_PEN) || test_bit(key, BTN_STYLUS);
+
+        if (multitouch && (direct || !test_bit(prop, INPUT_PROP_POINTER))) {  //部分旧驱动不设置DIRECT，但触摸板会设置POINTER
+            return DeviceClass::Touchscreen;
+        }
+        if (pen && test_bit(abs, ABS_X)) {
+            return DeviceClass::Stylus;
+        }
+        if (direct && test_bit(abs, ABS_X) && test_bit(key, BTN_TOUCH)) {  //单点触摸屏
+            return DeviceClass::Touchscreen;
+        }
+        if (test_bit(key, KEY_Q) && test_bit(key, KEY_A) && test_bit(key, KEY_Z) && test_bit(key, KEY_SPACE)) {
+            return DeviceClass::Keyboard;
+        }
+        return DeviceClass::Other;
+    }
+
+    bool accepted(DeviceClass cls) const {
+        switch (cls) {
+        case DeviceClass::Touchscreen:
+            return true;
+        case DeviceClass::Stylus:
+            return use_stylus_;
+        case DeviceClass::Keyboard:
+            return use_keyboard_;
+        default:
+            return false;
+        }
+    }
+
+    static std::string device_name(int fd) {
+        char name[128] = {0};
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) < 0) {
+            return "unknown";
+        }
+        return name;
+    }
+
+    static void resync(Device& dev) {  //从内核读取当前状态，用于打开时与事件丢失后
+        unsigned long keys[KEY_CNT / (8 * sizeof(unsigned long)) + 1] = {0};
+        if (ioctl(dev.fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+            dev.btn_touch = test_bit(keys, BTN_TOUCH);
+            dev.keys_down = 0;
+            if (dev.stats.cls == DeviceClass::Keyboard) {
+                for (int code = 1; code < BTN_MISC; ++code) {
+                    dev.keys_down += test_bit(keys, code) ? 1 : 0;
+                }
+            }
+        }
+
+        struct {
+            uint32_t code;
+            int32_t values[MAX_SLOTS];
+        } req = {};
+        req.code = ABS_MT_TRACKING_ID;
+        dev.slots = 0;
+        if (ioctl(dev.fd, EVIOCGMTSLOTS(sizeof(req)), &req) >= 0) {
+            for (int i = 0; i < MAX_SLOTS; ++i) {
+                if (req.values[i] >= 0) {
+                    dev.slots |= (1ULL << i);
+                }
+            }
+        }
+
+        struct input_absinfo slot = {};
+        if (ioctl(dev.fd, EVIOCGABS(ABS_MT_SLOT), &slot) >= 0) {
+            dev.slot = slot.value;
+        }
+        dev.down = is_down(dev);
+        for (auto& track : dev.tracks) {  //丢失的移动无法补回
+            track.reset();
+        }
+    }
+
+    static int64_t event_us(const struct input_event& ev) {
+#ifdef input_event_sec
+        return static_cast<int64_t>(ev.input_event_sec) * 1000000 + ev.input_event_usec;
+#else
+        return static_cast<int64_t>(ev.time.tv_sec) * 1000000 + ev.time.tv_usec;
+#endif
+    }
+
+    static void load_axes(Device& dev) {  //读取坐标范围
+        struct input_absinfo x = {}, y = {};
+        dev.multitouch = ioctl(dev.fd, EVIOCGABS(ABS_MT_POSITION_X), &x) >= 0 && x.maximum > x.minimum &&
+                         ioctl(dev.fd, EVIOCGABS(ABS_MT_POSITION_Y), &y) >= 0;
+        if (!dev.multitouch && (ioctl(dev.fd, EVIOCGABS(ABS_X), &x) < 0 || ioctl(dev.fd, EVIOCGABS(ABS_Y), &y) < 0)) {
+            return;  //键盘等没有坐标
+        }
+        dev.ax = {x.minimum, x.maximum - x.minimum};
+        dev.ay = {y.minimum, y.maximum - y.minimum};
+    }
+
+    Track* current_track(Device& dev) {
+        int slot = dev.multitouch ? dev.slot : 0;
+        return (slot >= 0 && slot < MAX_TRACKED) ? &dev.tracks[slot] : nullptr;
+    }
+
+    void lift(Device& dev, const struct input_event& ev) {  //触点抬起，记录速度
+        if (Track* track = current_track(dev)) {
+            release_velocity_ = track->velocity(event_us(ev));
+            track->reset();
+        }
+    }
+
+    static bool is_down(const Device& dev) {
+        return dev.btn_touch || dev.slots != 0 || dev.keys_down > 0;
+    }
+
+    bool add_device(const std::string& path) {  //打开、分类并注册单个设备节点
+        for (const auto& [fd, dev] : devices_) {
+            if (dev.stats.path == path) {
+                return false;  //已在读取
+            }
+        }
+
+        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            LOGW("Failed to open input device %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        DeviceStats stats;
+        stats.path = path;
+        stats.name = device_name(fd);
+        stats.cls = classify(fd);
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            ignored_.erase(std::remove_if(ignored_.begin(), ignored_.end(),
+                                          [&path](const DeviceStats& s) { return s.path == path; }),
+                           ignored_.end());  //节点可能被复用
+        }
+        if (!accepted(stats.cls)) {
+            LOGD("Input device skipped: %s (%s, %s)", path.c_str(), stats.name.c_str(), className(stats.cls));
+            close(fd);
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            ignored_.push_back(std::move(stats));
+            return false;
+        }
+        stats.monitored = true;
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            LOGW("Failed to add input device %s to epoll: %s", path.c_str(), strerror(errno));
+            close(fd);
+            return false;
+        }
+
+        Device dev;
+        dev.fd = fd;
+        dev.stats = std::move(stats);
+#ifdef EVIOCSCLOCKID
+        int clock_id = CLOCK_MONOTONIC;  //默认是CLOCK_REALTIME
+        dev.mono_clock = ioctl(fd, EVIOCSCLOCKID, &clock_id) == 0;
+#endif
+        load_axes(dev);
+        resync(dev);
+        LOGD("Input device opened: %s (%s, %s)", path.c_str(), dev.stats.name.c_str(), className(dev.stats.cls));
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        devices_[fd] = std::move(dev);
+        return true;
+    }
+
+    Change handle_hotplug() {  //处理/dev/input的增删
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t length;
+        while ((length = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+            for (char* ptr = buf; ptr < buf + length;) {
+                auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+                if (event->len == 0 || strncmp(event->name, "event", 5) != 0) {
+                    continue;
+                }
+
+                std::string path = dir_ + "/" + event->name;
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    int gone = -1;
+                    for (const auto& [fd, dev] : devices_) {
+                        if (dev.stats.path == path) {
+                            gone = fd;
+                        }
+                    }
+                    if (gone >= 0) {
+                        remove_device(gone);
+                    }
+                    std::lock_guard<std::mutex> lock(stats_mutex_);
+                    ignored_.erase(std::remove_if(ignored_.begin(), ignored_.end(),
+                                                  [&path](const DeviceStats& s) { return s.path == path; }),
+                                   ignored_.end());
+                } else if (add_device(path)) {  //IN_CREATE时权限可能尚未设置好，IN_ATTRIB时再试
+                    LOGI("Input device added: %s", path.c_str());
+                }
+            }
+        }
+        return update();
+    }
+
+    void remove_device(int fd) {
+        auto it = devices_.find(fd);
+        if (it == devices_.end()) {
+            return;
+        }
+        LOGI("Input device removed: %s", it->second.stats.path.c_str());
+        if (epoll_fd_ >= 0) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        close(fd);
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        devices_.erase(it);
+    }
+
+    void apply(Device& dev, const struct input_event& ev) {  //处理单个事件
+        if (dev.dropped) {
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+                dev.dropped = false;
+                resync(dev);
+            }
+            return;
+        }
+
+        switch (ev.type) {
+        case EV_SYN:
+            if (ev.code == SYN_REPORT) {
+                dev.down = is_down(dev);
+                dev.report_us = event_us(ev);
+                for (auto& track : dev.tracks) {
+                    if (track.moved) {
+                        track.push(dev.ax.normalize(track.x), dev.ay.normalize(track.y), event_us(ev));
+                        track.moved = false;
+                    }
+                }
+            } else if (ev.code == SYN_DROPPED) {
+                dev.dropped = true;
+            }
+            break;
+        case EV_KEY:
+            if (ev.code == BTN_TOUCH) {
+                dev.btn_touch = ev.value != 0;
+                if (!dev.multitouch && !dev.btn_touch) {
+                    lift(dev, ev);
+                }
+            } else if (dev.stats.cls == DeviceClass::Keyboard && ev.code < BTN_MISC && ev.value != 2) {  //忽略自动重复
+                dev.keys_down = std::max(0, dev.keys_down + (ev.value ? 1 : -1));
+            }
+            break;
+        case EV_ABS:
+            if (ev.code == ABS_MT_SLOT) {
+                dev.slot = ev.value;
+            } else if (ev.code == ABS_MT_TRACKING_ID && dev.slot >= 0 && dev.slot < MAX_SLOTS) {
+                if (ev.value >= 0) {
+                    dev.slots |= (1ULL << dev.slot);
+                    if (Track* track = current_track(dev)) {
+                        track->reset();
+                    }
+                } else {
+                    dev.slots &= ~(1ULL << dev.slot);
+                    lift(dev, ev);
+                }
+            } else if (dev.multitouch ? (ev.code == ABS_MT_POSITION_X || ev.code == ABS_MT_POSITION_Y)
+                                      : (ev.code == ABS_X || ev.code == ABS_Y)) {
+                if (Track* track = current_track(dev)) {
+                    (ev.code == ABS_MT_POSITION_X || ev.code == ABS_X ? track->x : track->y) = ev.value;
+                    track->moved = true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    Change update() {  //汇总所有设备的触摸状态
+        bool before = touching_;
+        touching_ = false;
+        for (const auto& [fd, dev] : devices_) {
+            if (dev.down) {
+                touching_ = true;
+                break;
+            }
+        }
+        if (touching_ == before) {
+            return Change::None;
+        }
+        return touching_ ? Change::Down : Change::Up;
+    }
+
+public:
+    InputReader() = default;
+
+    ~InputReader() {
+        detach();
+    }
+
+    void setFilter(bool stylus, bool keyboard) {  //下次attach时生效
+        use_stylus_ = stylus;
+        use_keyboard_ = keyboard;
+    }
+
+    bool attach(int epoll_fd, const std::string& dir = "/dev/input") {  //打开符合条件的event节点并注册到epoll
+        detach();
+        epoll_fd_ = epoll_fd;
+        dir_ = dir;
+
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);  //先监听再枚举，不漏掉其间加入的设备
+        if (inotify_fd_ >= 0) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = inotify_fd_;
+            if (inotify_add_watch(inotify_fd_, dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0 ||
+                epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, inotify_fd_, &event) < 0) {
+                LOGW("Input hotplug unavailable: %s", strerror(errno));
+                close(inotify_fd_);
+                inotify_fd_ = -1;
+            }
+        }
+
+        DIR* dp = opendir(dir.c_str());
+        if (!dp) {
+            LOGE("Failed to open %s: %s", dir.c_str(), strerror(errno));
+            return false;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(dp)) != nullptr) {
+            if (strncmp(entry->d_name, "event", 5) != 0) {
+                continue;
+            }
+            add_device(dir + "/" + entry->d_name);
+        }
+        closedir(dp);
+
+        update();
+        LOGI("Reading %zu input devices", devices_.size());
+        return !devices_.empty() || inotify_fd_ >= 0;  //能监听时可以等设备加入
+    }
+
+    void detach() {
+        std::vector<int> fds;
+        for (const auto& [fd, dev] : devices_) {
+            fds.push_back(fd);
+        }
+        if (inotify_fd_ >= 0) {
+            fds.push_back(inotify_fd_);
+            inotify_fd_ = -1;
+        }
+        for (int fd : fds) {
+            if (epoll_fd_ >= 0) {
+                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+            }
+            close(fd);
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            devices_.clear();
+            ignored_.clear();
+        }
+        touching_ = false;
+        epoll_fd_ = -1;
+    }
+
+    bool owns(int fd) const {
+        return (fd >= 0 && fd == inotify_fd_) || devices_.count(fd) != 0;
+    }
+
+    Change handle(int fd) {  //读取并解析该设备的所有待处理事件
+        if (fd >= 0 && fd == inotify_fd_) {
+            return handle_hotplug();
+        }
+        auto it = devices_.find(fd);
+        if (it == devices_.end()) {
+            return Change::None;
+        }
+        Device& dev = it->second;
+        bool was_down = dev.down;
+
+        struct input_event events[64];
+        ssize_t length;
+        while ((length = read(fd, events, sizeof(events))) > 0) {
+            size_t count = static_cast<size_t>(length) / sizeof(struct input_event);
+            for (size_t i = 0; i < count; ++i) {
+                apply(dev, events[i]);
+            }
+        }
+
+        bool gone = length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);  //ENODEV：设备被拔出
+        if (gone) {
+            dev.down = false;
+        }
+        Change change = update();
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            auto now = clock::now();
+            dev.stats.wakeups++;
+            if (change == Change::Down) {
+                dev.stats.boosts++;
+                dev.boosting = true;
+                dev.boost_start = now;
+                down_time_ = (dev.mono_clock && dev.report_us > 0)
+                                 ? clock::time_point(std::chrono::microseconds(dev.report_us))
+                                 : now;
+            }
+            if (was_down && !dev.down && dev.boosting) {
+                if (now - dev.boost_start < SPURIOUS_TIME) {
+                    dev.stats.spurious++;
+                }
+                dev.boosting = false;
+            }
+        }
+
+        if (gone) {
+            remove_device(fd);
+        }
+        return change;
+    }
+
+    bool touching() const {
+        return touching_;
+    }
+
+    std::chrono::steady_clock::time_point lastDownTime() const {  //用于统计从按下到刷新率生效的延迟
+        return down_time_;
+    }
+
+    float releaseVelocity() const {  //最后一次抬起时的速度，屏幕/秒，点击或停顿后抬起为0
+        return release_velocity_;
+    }
+
+    size_t deviceCount() const {
+        return devices_.size();
+    }
+
+    std::vector<DeviceStats> getStats() const {  //已读取与被跳过的设备
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        std::vector<DeviceStats> result;
+        for (const auto& [fd, dev] : devices_) {
+            result.push_back(dev.stats);
+        }
+        result.insert(result.end(), ignored_.begin(), ignored_.end());
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,473 @@
+/* 二进制功耗记录 */
+/* 只追加的定长记录：运行中只写入增量，定期写入全部累计值作为检查点，文件过大时整理为只含一个检查点的新文件 */
+/* 读取时mmap整个文件，从头校验到第一条损坏的记录为止，截掉写了一半的尾部；恢复为最后一个完整检查点加其后的增量 */
+#ifndef POWER_LOG_HPP
+#define POWER_LOG_HPP
+
+#include "Alog.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// 应用功耗记录结构体
+struct AppPower {
+    float time_sec = 0.0f;      // 应用运行时间（秒）
+    float power_joules = 0.0f;  // 焦耳累计
+};
+
+class PowerLog {
+public:
+    using PowerMap = std::unordered_map<std::string, AppPower>;
+
+    explicit PowerLog(std::string path)
+        : path_(std::move(path)) {}
+
+    ~PowerLog() {
+        close_fd();
+    }
+
+    PowerLog(const PowerLog&) = delete;
+    PowerLog& operator=(const PowerLog&) = delete;
+
+    bool exists() const {
+        return access(path_.c_str(), F_OK) == 0;
+    }
+
+    /*读取并恢复，返回false表示文件不存在或无法识别(此时totals不变)
+      尾部损坏的记录会被截掉，之后的追加接在最后一条完整记录后面*/
+    bool load(PowerMap& totals, int& unit) {
+        close_fd();
+        ids_.clear();
+        next_id_ = 0;
+
+        int fd = open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            return discard("too short");
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            LOGW("PowerLog: mmap failed: %s", strerror(errno));
+            ::close(fd);
+            return false;
+        }
+
+        const auto* base = static_cast<const uint8_t*>(map);
+        Header header;
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION ||
+            header.record_size != sizeof(Record)) {
+            munmap(map, size);
+            ::close(fd);
+            return discard("unknown header");
+        }
+
+        Replay replay;
+        size_t offset = sizeof(Header);
+        for (; offset + sizeof(Record) <= size; offset += sizeof(Record)) {
+            Record record;
+            memcpy(&record, base + offset, sizeof(record));
+            if (record.crc != crc32(&record, offsetof(Record, crc))) {
+                break;
+            }
+            replay.apply(record);
+        }
+        munmap(map, size);
+
+        if (offset != size) {  //写了一半或损坏的尾部
+            LOGW("PowerLog: dropped %zu damaged bytes at the end", size - offset);
+            if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+                LOGW("PowerLog: ftruncate failed: %s", strerror(errno));
+            }
+        }
+        fd_ = fd;
+        size_ = offset;
+
+        totals.clear();
+        for (auto& [id, name] : replay.names) {  //编号不重复使用
+            if (name.size() != replay.lengths[id]) {
+                name.clear();
+            }
+            if (!name.empty()) {
+                ids_[name] = id;
+            }
+            next_id_ = std::max<uint16_t>(next_id_, id + 1);
+        }
+        for (const auto& [id, power] : replay.totals) {
+            auto name = replay.names.find(id);
+            if (name != replay.names.end() && !name->second.empty()) {
+                totals[name->second] = power;
+            }
+        }
+        if (replay.unit >= 0) {
+            unit = replay.unit;
+        }
+        LOGD("PowerLog: recovered %zu apps from %zu records", totals.size(), (size_ - sizeof(Header)) / sizeof(Record));
+        return true;
+    }
+
+    /*追加增量，每个应用一条记录，首次出现的应用先写名字
+      返回false时增量未写入，调用者应写检查点(编号用尽时检查点会整理文件)*/
+    bool append(const PowerMap& deltas) {
+        if (deltas.empty()) {
+            return true;
+        }
+        if (fd_ < 0 && !create()) {
+            return false;
+        }
+        std::vector<Record> records;
+        for (const auto& [name, power] : deltas) {
+            uint16_t id;
+            if (!assign(name, id, records)) {
+                rollback();
+                return false;
+            }
+            records.push_back(power_record(DELTA, id, power));
+        }
+        return write_records(records, false);
+    }
+
+    /*写入检查点：全部累计值与单位。文件较大或编号将用尽时整理为新文件*/
+    bool checkpoint(const PowerMap& totals, int unit) {
+        if (fd_ >= 0 && size_ < COMPACT_SIZE && next_id_ < COMPACT_IDS) {
+            std::vector<Record> records;
+            Record begin = make(BEGIN, 0, static_cast<uint32_t>(totals.size()));
+            records.push_back(begin);
+            std::vector<Record> names;
+            std::vector<Record> entries;
+            for (const auto& [name, power] : totals) {
+                uint16_t id;
+                if (!assign(name, id, names)) {
+                    rollback();
+                    return compact(totals, unit);
+                }
+                entries.push_back(power_record(TOTAL, id, power));
+            }
+            records.insert(records.begin(), names.begin(), names.end());
+            records.insert(records.end(), entries.begin(), entries.end());
+            records.push_back(end_record(totals.size(), unit));
+            return write_records(records, true);
+        }
+        return compact(totals, unit);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'B', 'S', 'P', 'W', 'R', 'L', 'O', 'G'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t COMPACT_SIZE = 256 * 1024;  //超过后在下个检查点整理
+    static constexpr uint16_t COMPACT_IDS = 0xF000;
+
+    enum Type : uint8_t {
+        NAME = 1,   //应用名片段：app为编号，value为总长度，part为片段序号
+        DELTA = 2,  //增量
+        BEGIN = 3,  //检查点开始：value为条目数
+        TOTAL = 4,  //检查点中的累计值
+        END = 5,    //检查点结束：value为条目数，data为单位
+    };
+
+    struct Header {  //32字节
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint8_t reserved[16];
+    };
+
+    struct Record {  //32字节，crc覆盖前28字节
+        uint8_t type;
+        uint8_t part;
+        uint16_t app;
+        uint32_t value;
+        uint8_t data[20];
+        uint32_t crc;
+    };
+    static_assert(sizeof(Header) == 32 && sizeof(Record) == 32, "power log layout");
+
+    static constexpr size_t NAME_CHUNK = sizeof(Record::data);
+
+    struct Replay {  //按顺序重放记录
+        std::unordered_map<uint16_t, std::string> names;
+        std::unordered_map<uint16_t, size_t> lengths;  //名字的完整长度，片段不全的名字不使用
+        std::unordered_map<uint16_t, AppPower> totals;
+        std::unordered_map<uint16_t, AppPower> staging;  //未结束的检查点
+        size_t staged = 0;
+        bool in_checkpoint = false;
+        int unit = -1;
+
+        void apply(const Record& record) {
+            switch (record.type) {
+            case NAME: {
+                std::string& name = names[record.app];
+                if (record.part == 0) {
+                    name.clear();
+                }
+                size_t offset = static_cast<size_t>(record.part) * NAME_CHUNK;
+                if (offset != name.size() || offset >= record.value || record.value > 255 * NAME_CHUNK) {
+                    name.clear();  //片段不连续，丢弃
+                    break;
+                }
+                name.append(reinterpret_cast<const char*>(record.data),
+                            std::min(NAME_CHUNK, static_cast<size_t>(record.value) - offset));
+                lengths[record.app] = record.value;
+                break;
+            }
+            case DELTA: {
+                AppPower power = read_power(record);
+                AppPower& total = totals[record.app];
+                total.time_sec += power.time_sec;
+                total.power_joules += power.power_joules;
+                break;
+            }
+            case BEGIN:
+                staging.clear();
+                staged = record.value;
+                in_checkpoint = true;
+                break;
+            case TOTAL:
+                if (in_checkpoint) {
+                    staging[record.app] = read_power(record);
+                }
+                break;
+            case END:
+                if (in_checkpoint && record.value == staged && staging.size() == staged) {
+                    totals.swap(staging);
+                    int32_t value;
+                    memcpy(&value, record.data, sizeof(value));
+                    unit = value;
+                }
+                staging.clear();
+                in_checkpoint = false;
+                break;
+            default:
+                break;
+            }
+        }
+    };
+
+    std::string path_;
+    int fd_ = -1;
+    size_t size_ = 0;
+    std::unordered_map<std::string, uint16_t> ids_;
+    std::vector<std::string> unwritten_;  //本次新分配、名字尚未写入的应用
+    uint16_t next_id_ = 0;
+
+    static uint32_t crc32(const void* data, size_t length) {
+        static const auto table = []() {
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        const auto* p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < length; ++i) {
+            crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    static Record make(Type type, uint16_t app, uint32_t value) {
+        Record record;
+        memset(&record, 0, sizeof(record));
+        record.type = type;
+        record.app = app;
+        record.value = value;
+        return record;
+    }
+
+    static Record power_record(Type type, uint16_t app, const AppPower& power) {
+        Record record = make(type, app, 0);
+        memcpy(record.data, &power.time_sec, sizeof(float));
+        memcpy(record.data + sizeof(float), &power.power_joules, sizeof(float));
+        return record;
+    }
+
+    static AppPower read_power(const Record& record) {
+        AppPower power;
+        memcpy(&power.time_sec, record.data, sizeof(float));
+        memcpy(&power.power_joules, record.data + sizeof(float), sizeof(float));
+        return power;
+    }
+
+    static Record end_record(size_t count, int unit) {
+        Record record = make(END, 0, static_cast<uint32_t>(count));
+        int32_t value = unit;
+        memcpy(record.data, &value, sizeof(value));
+        return record;
+    }
+
+    static void name_records(const std::string& name, uint16_t id, std::vector<Record>& records) {
+        size_t length = std::min(name.size(), 255 * NAME_CHUNK);
+        for (size_t offset = 0, part = 0; offset < length; offset += NAME_CHUNK, ++part) {
+            Record record = make(NAME, id, static_cast<uint32_t>(length));
+            record.part = static_cast<uint8_t>(part);
+            memcpy(record.data, name.data() + offset, std::min(NAME_CHUNK, length - offset));
+            records.push_back(record);
+        }
+    }
+
+    bool assign(const std::string& name, uint16_t& id, std::vector<Record>& records) {  //取得编号，新应用把名字写入records
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            id = it->second;
+            return true;
+        }
+        if (next_id_ >= COMPACT_IDS) {
+            return false;
+        }
+        id = next_id_++;
+        ids_[name] = id;
+        unwritten_.push_back(name);
+        name_records(name, id, records);
+        return true;
+    }
+
+    void rollback() {  //写入失败时撤销新分配的编号，下次重新写名字
+        for (const auto& name : unwritten_) {
+            ids_.erase(name);
+        }
+        unwritten_.clear();
+    }
+
+    bool write_records(std::vector<Record>& records, bool sync) {  //一次write写入，失败时截回原长度
+        for (auto& record : records) {
+            record.crc = crc32(&record, offsetof(Record, crc));
+        }
+        size_t bytes = records.size() * sizeof(Record);
+        ssize_t written = ::write(fd_, records.data(), bytes);
+        if (written != static_cast<ssize_t>(bytes)) {
+            LOGW("PowerLog: append failed: %s", written < 0 ? strerror(errno) : "short write");
+            rollback();
+            if (ftruncate(fd_, static_cast<off_t>(size_)) != 0 || lseek(fd_, 0, SEEK_END) < 0) {
+                close_fd();
+            }
+            return false;
+        }
+        unwritten_.clear();
+        size_ += bytes;
+        if (sync) {
+            fdatasync(fd_);
+        }
+        return true;
+    }
+
+    static bool write_header(int fd) {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.record_size = sizeof(Record);
+        return ::write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header));
+    }
+
+    bool create() {  //新建只有文件头的记录
+        int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0 || !write_header(fd)) {
+            LOGW("PowerLog: failed to create %s: %s", path_.c_str(), strerror(errno));
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+        fd_ = fd;
+        size_ = sizeof(Header);
+        ids_.clear();
+        unwritten_.clear();
+        next_id_ = 0;
+        return true;
+    }
+
+    bool compact(const PowerMap& totals, int unit) {  //写入临时文件后rename，任何时刻磁盘上都有一份完整记录
+        std::string tmp = path_ + ".tmp";
+        int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0 || !write_header(fd)) {
+            LOGW("PowerLog: failed to create %s: %s", tmp.c_str(), strerror(errno));
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return false;
+        }
+
+        int old_fd = fd_;
+        size_t old_size = size_;
+        auto old_ids = std::move(ids_);
+        uint16_t old_next = next_id_;
+        unwritten_.clear();
+
+        fd_ = fd;
+        size_ = sizeof(Header);
+        ids_.clear();
+        next_id_ = 0;
+
+        std::vector<Record> records;
+        std::vector<Record> entries;
+        for (const auto& [name, power] : totals) {
+            uint16_t id;
+            assign(name, id, records);
+            entries.push_back(power_record(TOTAL, id, power));
+        }
+        records.push_back(make(BEGIN, 0, static_cast<uint32_t>(totals.size())));
+        records.insert(records.end(), entries.begin(), entries.end());
+        records.push_back(end_record(totals.size(), unit));
+
+        if (!write_records(records, true) || fd_ < 0 || rename(tmp.c_str(), path_.c_str()) != 0) {
+            LOGW("PowerLog: compaction failed, keeping the old log");
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+            unlink(tmp.c_str());
+            fd_ = old_fd;
+            size_ = old_size;
+            ids_ = std::move(old_ids);
+            unwritten_.clear();
+            next_id_ = old_next;
+            return false;
+        }
+        if (old_fd >= 0) {
+            ::close(old_fd);
+        }
+        LOGD("PowerLog: compacted to %zu bytes", size_);
+        return true;
+    }
+
+    bool discard(const char* reason) {  //无法识别的文件改名保留，不覆盖
+        std::string bad = path_ + ".bad";
+        LOGW("PowerLog: %s is unusable (%s), moved to %s", path_.c_str(), reason, bad.c_str());
+        rename(path_.c_str(), bad.c_str());
+        return false;
+    }
+
+    void close_fd() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        size_ = 0;
+    }
+};
+
+#endif
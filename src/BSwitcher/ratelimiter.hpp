@@ -0,0 +1,68 @@
+/* 令牌桶限流器，用于限制模式切换的频率 */
+/* 非线程安全，只在主循环中使用 */
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <chrono>
+
+class TokenBucket {
+private:
+    using clock = std::chrono::steady_clock;
+
+    int burst_ = 0;      //桶容量，<=0时不限流
+    int refill_ms_ = 0;  //补充一个令牌所需的时间
+    double tokens_ = 0.0;
+    clock::time_point last_ = clock::now();
+
+    void refill() {
+        auto now = clock::now();
+        if (refill_ms_ > 0) {
+            double elapsed = std::chrono::duration<double, std::milli>(now - last_).count();
+            tokens_ = std::min(static_cast<double>(burst_), tokens_ + elapsed / refill_ms_);
+        } else {
+            tokens_ = burst_;
+        }
+        last_ = now;
+    }
+
+public:
+    void configure(int burst, int refill_ms) {  //参数不变时不重置桶
+        if (burst == burst_ && refill_ms == refill_ms_) {
+            return;
+        }
+        burst_ = burst;
+        refill_ms_ = std::max(0, refill_ms);
+        tokens_ = std::max(0, burst_);
+        last_ = clock::now();
+    }
+
+    bool enabled() const {
+        return burst_ > 0;
+    }
+
+    bool tryAcquire() {  //取一个令牌
+        if (!enabled()) {
+            return true;
+        }
+        refill();
+        if (tokens_ >= 1.0) {
+            tokens_ -= 1.0;
+            return true;
+        }
+        return false;
+    }
+
+    int msUntilToken() {  //距离下一个可用令牌的时间
+        if (!enabled()) {
+            return 0;
+        }
+        refill();
+        if (tokens_ >= 1.0) {
+            return 0;
+        }
+        return static_cast<int>((1.0 - tokens_) * refill_ms_) + 1;
+    }
+};
+
+#endif
@@ -0,0 +1,166 @@
+/* 进程内共享的事件循环 */
+/* inotify、timerfd、eventfd等都挂在同一个epoll上，由一个小栈线程统一分发 */
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include "Alog.hpp"
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <unordered_map>
+
+class Reactor {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    static Reactor& instance() {  //随进程存在，不析构，避免与其他静态对象的析构顺序问题
+        static Reactor* reactor = new Reactor();
+        return *reactor;
+    }
+
+    bool add(int fd, uint32_t events, Handler handler) {  //注册fd，handler在分发线程中执行
+        if (fd < 0 || epoll_fd_ < 0) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t gen = ++generation_;  //防止fd被复用后收到旧fd的事件
+        if (gen == 0) {
+            gen = ++generation_;
+        }
+
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.u64 = (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            LOGE("Reactor: failed to add fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+
+        handlers_[fd] = {gen, std::make_shared<Handler>(std::move(handler))};
+        start_locked();
+        return true;
+    }
+
+    void remove(int fd) {  //返回后保证handler不再被调用
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = handlers_.find(fd);
+        if (it == handlers_.end()) {
+            return;
+        }
+        handlers_.erase(it);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+
+        if (!started_ || !pthread_equal(pthread_self(), thread_)) {  //在分发线程中移除时不能等待自己
+            cv_.wait(lock, [this, fd]() { return dispatching_fd_ != fd; });
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return handlers_.size();
+    }
+
+private:
+    struct Entry {
+        uint32_t gen;
+        std::shared_ptr<Handler> handler;
+    };
+
+    static const int MAX_EVENTS = 16;
+    static const size_t STACK_SIZE = 256 * 1024;  //只做分发，不需要默认的大栈
+
+    int epoll_fd_{-1};
+    pthread_t thread_{};
+    bool started_{false};
+    uint32_t generation_{0};
+    int dispatching_fd_{-1};
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unordered_map<int, Entry> handlers_;
+
+    Reactor() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) {
+            LOGE("Reactor: failed to create epoll instance: %s", strerror(errno));
+            return;
+        }
+    }
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    void start_locked() {  //首次注册时才启动线程
+        if (started_) {
+            return;
+        }
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, STACK_SIZE);
+        if (pthread_create(&thread_, &attr, &Reactor::thread_entry, this) == 0) {
+            started_ = true;
+            LOGD("Reactor thread started");
+        } else {
+            LOGE("Reactor: failed to start thread");
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    static void* thread_entry(void* arg) {
+        static_cast<Reactor*>(arg)->loop();
+        return nullptr;
+    }
+
+    void loop() {
+        sigset_t mask;
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+
+        struct epoll_event events[MAX_EVENTS];
+
+        while (true) {
+            int num_events = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+            if (num_events < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOGE("Reactor: epoll_wait() failed: %s", strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < num_events; ++i) {
+                int fd = static_cast<int>(events[i].data.u64 & 0xFFFFFFFFu);
+                uint32_t gen = static_cast<uint32_t>(events[i].data.u64 >> 32);
+
+                std::shared_ptr<Handler> handler;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    auto it = handlers_.find(fd);
+                    if (it == handlers_.end() || it->second.gen != gen) {  //已被移除
+                        continue;
+                    }
+                    handler = it->second.handler;
+                    dispatching_fd_ = fd;
+                }
+
+                (*handler)(events[i].events);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    dispatching_fd_ = -1;
+                }
+                cv_.notify_all();
+            }
+        }
+    }
+};
+
+#endif
@@ -56,6 +56,7 @@ export class ConfigManager {
                         mode: rule.mode,
                         up_fps: rule.up_fps,
                         down_fps: rule.down_fps,
+                        fps_decay: rule.fps_decay || '',
                     }))
             };
 
@@ -96,6 +97,7 @@ export class ConfigManager {
         // 检查是否已存在该应用的规则，如果存在则更新
         const existingIndex = this.config.rules.findIndex(rule => rule.appPackage === appPackage);
         if (existingIndex >= 0) {
+            rule.fps_decay = this.config.rules[existingIndex].fps_decay || '';  // 界面不编辑此项，保留原值
             this.config.rules[existingIndex] = rule;
             this.showToast(`已更新规则: ${appName}`);
         } else {
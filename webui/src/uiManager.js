@@ -46,7 +46,8 @@ export class UIManager {
                 target: 'dynamicFps',
                 mode: 'read'
             };
-            const fpsList = await this.socketClient.communicate(request);
+            const result = await this.socketClient.communicate(request);
+            const fpsList = Array.isArray(result) ? result : (result.fpslist || []);  //旧版本直接返回数组
 
             this.availableFps = [-1, ...fpsList.map(fps => Number(fps))];
             console.log('可用FPS列表:', this.availableFps);